@@ -0,0 +1,35 @@
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+// storage behind the disk image, disk.c only talks to the image through one of these
+
+enum {
+    IO_READ = 0,
+    IO_WRITE = 1,
+    IO_SYNC = 2,     // make [off, off + len) durable, pread and uring sync all the data
+    IO_DISCARD = 3,  // drop [off, off + len), it reads as zeros after
+};
+
+typedef struct {
+    int op;
+    long off;
+    long len;
+    char *buf;  // unused by IO_SYNC and IO_DISCARD
+} disk_io;
+
+typedef struct {
+    const char *name;
+    // open the image, fd is already stretched to size bytes, 0 on success
+    // the backend owns fd from here on
+    int (*open)(int fd, const char *filename, long size, int direct);
+    // run n operations, a backend may issue them together, 0 if all succeeded
+    // a sync covers the operations before it in ios and none after it
+    int (*submit)(disk_io *ios, int n);
+    void (*close)();
+} backend;
+
+extern backend mmap_backend;   // MAP_SHARED mapping of the whole image
+extern backend pread_backend;  // pread/pwrite, O_DIRECT optional
+extern backend uring_backend;  // io_uring, a batch is one submission
+
+#endif
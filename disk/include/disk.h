@@ -3,10 +3,39 @@
 
 #define BLOCKSIZE 512
 
+// when writes reach the disk file
+enum {
+    DUR_SYNC = 0,       // msync every write before replying
+    DUR_GROUP = 1,      // a flusher thread syncs every interval ms or nwrites writes
+    DUR_WRITEBACK = 2,  // sync only on disk_cmd_f() and close_disk()
+};
+
+// parse "sync", "group[:ms[:writes]]" or "writeback", return -1 if invalid
+int parse_durability(const char *arg, int *mode, int *interval, int *nwrites);
+// call before init_disk()
+void set_durability(int mode, int interval, int nwrites);
+// storage backend, "mmap" (default), "pread" or "uring", with ":direct" for
+// O_DIRECT, call before init_disk(), return -1 if unknown
+int set_backend(const char *spec);
+// access timing, "linear" (default) or "hdd[:rpm[:full stroke ms]]", see
+// hddmodel.h, spec may be NULL to keep the model, call before init_disk(),
+// return -1 if invalid
+int set_timing(const char *spec, int virtual_clock);
+
 int init_disk(char* filename, int ncyl, int nsec, int ttd);
-int cmd_i(int *ncyl, int *nsec);
-int cmd_r(int cyl, int sec, char *buf);
-int cmd_w(int cyl, int sec, int len, char *data);
+int disk_cmd_i(int *ncyl, int *nsec);
+int disk_cmd_r(int cyl, int sec, char *buf);
+int disk_cmd_w(int cyl, int sec, int len, char *data);
+// n consecutive sectors from (cyl, sec), may cross into the next cylinders
+int disk_cmd_rv(int cyl, int sec, int n, char *buf);
+int disk_cmd_wv(int cyl, int sec, int n, char *data);
+// drop n consecutive sectors (at most BDS_MAXDISCARD), they read as zeros
+// until written again, without going to the image
+int disk_cmd_d(int cyl, int sec, int n);
+// barrier, every write completed before it is in the file when it returns
+int disk_cmd_f();
+// access statistics as text into buf, then start over if reset, see diskstats.h
+int disk_cmd_s(char *buf, int size, int reset);
 void close_disk();
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef __DISKSTATS_H__
+#define __DISKSTATS_H__
+
+// counters kept by disk.c for every access, reported by the S command
+
+enum {
+    STAT_READ = 0,
+    STAT_WRITE = 1,
+};
+
+// buckets of the seek distance histogram: 0, 1, 2-3, 4-7, ...
+#define STAT_SEEK_BUCKETS 16
+
+void stats_init(int ncyl);
+void stats_reset();
+
+// one request of n sectors at cyl, service_ms covers the modeled delay and the backend
+void stats_access(int op, int cyl, int n, double service_ms);
+// time the timing model charged, and time spent syncing the image
+void stats_delay(double ms);
+void stats_sync(double ms);
+
+// seek distance histogram bucket of a distance
+int stats_seek_bucket(int distance);
+// service time in ms below which the fraction q (0..1) of requests finished
+double stats_percentile(double q);
+
+// human readable report, at most size bytes including the terminating 0,
+// returns its length
+int stats_format(char *buf, int size);
+// log the report every interval_s seconds from a background thread, 0 stops it
+void stats_periodic(int interval_s);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __HDDMODEL_H__
+#define __HDDMODEL_H__
+
+// how long an access to the simulated disk takes
+enum {
+    TIMING_LINEAR = 0,  // track-to-track delay per cylinder moved, nothing else
+    TIMING_HDD = 1,     // seek curve, rotational latency and transfer time
+};
+
+// parse "linear" or "hdd[:rpm[:full stroke ms]]", -1 if invalid
+// rpm and full_ms are left alone when not given
+int hdd_parse(const char *spec, int *model, int *rpm, double *full_ms);
+
+// t2t_ms is the track-to-track seek, with a virtual clock accesses
+// advance the simulated time instead of sleeping
+void hdd_init(int model, int ncyl, int nsec, double t2t_ms, int rpm, double full_ms, int virtual_clock);
+
+// seek time in ms over distance cylinders
+double hdd_seek_time(int distance);
+
+// move the head to (cyl, sec) and transfer n sectors, crossing into the
+// following cylinders if needed, returns the service time in ms
+double hdd_access(int cyl, int sec, int n);
+
+// simulated time in ms, the sum of all service times with a virtual clock
+double hdd_now();
+
+// totals since hdd_init, times in ms
+void hdd_stats(long *nreq, long *nsect, double *seek_ms, double *rot_ms, double *xfer_ms);
+void hdd_report();
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __IOSCHED_H__
+#define __IOSCHED_H__
+
+// request scheduling policies, keyed on cylinder
+enum {
+    SCHED_FCFS = 0,   // arrival order
+    SCHED_SSTF = 1,   // shortest seek first
+    SCHED_SCAN = 2,   // elevator, sweeps up and down
+    SCHED_CLOOK = 3,  // sweeps up only, jumps back to the lowest request
+};
+
+// parse a policy name ("fcfs", "sstf", "scan", "clook"), -1 if unknown
+int sched_parse(const char *name);
+const char *sched_name(int policy);
+
+void sched_init(int policy);
+
+// pick the next request among cyls[0..n), cyls in arrival order
+// head is the current cylinder, *dir is the sweep direction (1 or -1)
+// and may be reversed by SCAN, returns an index into cyls
+int sched_pick(int policy, int head, int *dir, const int *cyls, int n);
+
+// same as sched_pick with the configured policy and the current head,
+// used to order the requests queued on one connection
+int sched_choose(const int *cyls, int n);
+
+// wait until the scheduler chooses this request, then own the disk
+void sched_enter(int cyl);
+// release the disk, let the next queued request run
+void sched_leave();
+
+// seek distance in cylinders, as serviced and as FCFS would have paid
+void sched_stats(long *nreq, long *seek, long *fcfs_seek);
+void sched_report();
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "log.h"
+
+static char *diskfile;
+static long filesize, pagesize;
+
+static int mmap_open(int fd, const char *filename, long size, int direct) {
+    if (direct) Warn("mmap backend: O_DIRECT ignored");
+    diskfile = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(diskfile == MAP_FAILED){
+        Log("Error: Could not map file.\n");
+        return -1;
+    }
+    filesize = size;
+    pagesize = sysconf(_SC_PAGESIZE);
+    if(pagesize == -1) pagesize = 4096;
+    return 0;
+}
+
+static int mmap_submit(disk_io *ios, int n) {
+    int ret = 0;
+    for (int i = 0; i < n; ++i) {
+        disk_io *io = &ios[i];
+        if (io->op == IO_READ) {
+            memcpy(io->buf, diskfile + io->off, io->len);
+        } else if (io->op == IO_WRITE) {
+            memcpy(diskfile + io->off, io->buf, io->len);
+        } else if (io->op == IO_DISCARD) {
+            // MADV_REMOVE punches whole pages out of the file, the ragged ends are zeroed
+            char *start = diskfile + io->off, *end = start + io->len;
+            char *pstart = (char *)(((uintptr_t)start + pagesize - 1) & ~(pagesize - 1));
+            char *pend = (char *)((uintptr_t)end & ~(pagesize - 1));
+            if (pstart < pend && madvise(pstart, pend - pstart, MADV_REMOVE) == 0) {
+                memset(start, 0, pstart - start);
+                memset(pend, 0, end - pend);
+            } else {
+                memset(start, 0, io->len);
+            }
+        } else {
+            // msync wants a page aligned start, the length needs no rounding
+            char *sync_start = (char *)((uintptr_t)(diskfile + io->off) & ~(pagesize - 1));
+            if (msync(sync_start, diskfile + io->off + io->len - sync_start, MS_SYNC) == -1) ret = -1;
+        }
+    }
+    return ret;
+}
+
+static void mmap_close() {
+    if (diskfile != NULL && diskfile != MAP_FAILED) {
+        msync(diskfile, filesize, MS_SYNC);
+        if(munmap(diskfile, filesize) == -1){
+            Log("Error: Munmap failed.");
+        }
+        diskfile = NULL;
+    }
+}
+
+backend mmap_backend = {
+    .name = "mmap",
+    .open = mmap_open,
+    .submit = mmap_submit,
+    .close = mmap_close,
+};
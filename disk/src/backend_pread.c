@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "log.h"
+
+// O_DIRECT wants buffer, offset and length aligned to the device block size
+#define ALIGN 4096
+
+static int fd = -1;
+static int is_direct;
+// serializes read-modify-write of partially covered aligned blocks
+static pthread_mutex_t rmw_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int full_io(int op, long off, long len, char *buf) {
+    while (len > 0) {
+        long ret = op == IO_READ ? pread(fd, buf, len, off) : pwrite(fd, buf, len, off);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        off += ret;
+        len -= ret;
+        buf += ret;
+    }
+    return 0;
+}
+
+// O_DIRECT access that is not aligned goes through an aligned bounce buffer
+static int bounce_io(disk_io *io) {
+    long start = io->off & ~(long)(ALIGN - 1);
+    long end = (io->off + io->len + ALIGN - 1) & ~(long)(ALIGN - 1);
+    char *bounce;
+    if (posix_memalign((void **)&bounce, ALIGN, end - start)) return -1;
+    pthread_mutex_lock(&rmw_lock);
+    int ret = full_io(IO_READ, start, end - start, bounce);
+    if (ret == 0) {
+        if (io->op == IO_READ) {
+            memcpy(io->buf, bounce + (io->off - start), io->len);
+        } else {
+            memcpy(bounce + (io->off - start), io->buf, io->len);
+            ret = full_io(IO_WRITE, start, end - start, bounce);
+        }
+    }
+    pthread_mutex_unlock(&rmw_lock);
+    free(bounce);
+    return ret;
+}
+
+static int write_one(disk_io *io) {
+    if (is_direct && (io->off % ALIGN || io->len % ALIGN || (uintptr_t)io->buf % ALIGN)) return bounce_io(io);
+    return full_io(io->op, io->off, io->len, io->buf);
+}
+
+// punch a hole, or write zeros where the file system cannot
+static int discard(long off, long len) {
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, len) == 0) return 0;
+    if (errno != EOPNOTSUPP) return -1;
+    char *zero;
+    if (posix_memalign((void **)&zero, ALIGN, 16 * ALIGN)) return -1;
+    memset(zero, 0, 16 * ALIGN);
+    int ret = 0;
+    for (long done = 0; done < len && ret == 0; done += 16 * ALIGN) {
+        disk_io io = {IO_WRITE, off + done, len - done < 16 * ALIGN ? len - done : 16 * ALIGN, zero};
+        ret = write_one(&io);
+    }
+    free(zero);
+    return ret;
+}
+
+static int pread_open(int _fd, const char *filename, long size, int direct) {
+    fd = _fd;
+    is_direct = 0;
+    if (direct) {
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == -1) {
+            Warn("pread backend: O_DIRECT not supported for '%s', using the page cache", filename);
+        } else {
+            is_direct = 1;
+        }
+    }
+    return 0;
+}
+
+static int pread_submit(disk_io *ios, int n) {
+    int ret = 0, synced = 0;
+    for (int i = 0; i < n; ++i) {
+        disk_io *io = &ios[i];
+        if (io->op == IO_SYNC) {
+            // sync_file_range() would leave the metadata and the device cache,
+            // fdatasync() covers the whole file, once for a run of syncs
+            if (!synced && fdatasync(fd) == -1) ret = -1;
+            synced = 1;
+        } else if (io->op == IO_DISCARD) {
+            if (discard(io->off, io->len)) ret = -1;
+            synced = 0;
+        } else {
+            if (write_one(io)) ret = -1;
+            synced &= io->op == IO_READ;
+        }
+    }
+    return ret;
+}
+
+static void pread_close() {
+    if (fd >= 0) {
+        fdatasync(fd);
+        close(fd);
+        fd = -1;
+    }
+}
+
+backend pread_backend = {
+    .name = "pread",
+    .open = pread_open,
+    .submit = pread_submit,
+    .close = pread_close,
+};
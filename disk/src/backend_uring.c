@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "log.h"
+
+// no liburing here, the ring is driven with the raw system calls
+
+#define QDEPTH 64
+
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+} ring = {.fd = -1};
+
+static int fd = -1;
+static int fallback;  // io_uring is not available, use pread_backend
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int ring_setup() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring.fd = syscall(__NR_io_uring_setup, QDEPTH, &p);
+    if (ring.fd < 0) return -1;
+
+    ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_size > ring.sq_size) ring.sq_size = ring.cq_size;
+        ring.cq_size = ring.sq_size;
+    }
+    ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                       IORING_OFF_SQ_RING);
+    if (ring.sq_ptr == MAP_FAILED) return -1;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ptr = ring.sq_ptr;
+    } else {
+        ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                           IORING_OFF_CQ_RING);
+        if (ring.cq_ptr == MAP_FAILED) return -1;
+    }
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+                     IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) return -1;
+
+    char *sq = ring.sq_ptr, *cq = ring.cq_ptr;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void ring_teardown() {
+    if (ring.sqes && ring.sqes != MAP_FAILED) munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ptr && ring.cq_ptr != MAP_FAILED && ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_size);
+    if (ring.sq_ptr && ring.sq_ptr != MAP_FAILED) munmap(ring.sq_ptr, ring.sq_size);
+    if (ring.fd >= 0) close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+static int uring_open(int _fd, const char *filename, long size, int direct) {
+    if (direct) Warn("uring backend: O_DIRECT ignored");
+    if (ring_setup() < 0) {
+        Warn("uring backend: io_uring unavailable (%s), falling back to pread", strerror(errno));
+        ring_teardown();
+        fallback = 1;
+        return pread_backend.open(_fd, filename, size, 0);
+    }
+    fallback = 0;
+    fd = _fd;
+    return 0;
+}
+
+// a discard where the file system cannot punch holes, write zeros instead
+static int zero_range(long off, long len) {
+    static const char zero[65536];
+    while (len > 0) {
+        long ret = pwrite(fd, zero, len < sizeof(zero) ? len : sizeof(zero), off);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        off += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+// the rest of a transfer the ring did in part, until it is done, fails or
+// meets the end of the file
+static int finish_io(int op, long off, long len, char *buf) {
+    while (len > 0) {
+        long ret = op == IO_READ ? pread(fd, buf, len, off) : pwrite(fd, buf, len, off);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return -1;
+        off += ret;
+        len -= ret;
+        buf += ret;
+    }
+    return 0;
+}
+
+// queue ios[0..n), n <= QDEPTH, submit them with one system call and reap them all
+static int ring_batch(disk_io *ios, int n) {
+    unsigned tail = *ring.sq_tail;
+    int synced = 0;  // a sync is queued and nothing changed the file after it
+    int has_sync = 0, patched = 0;  // a sync in the batch, data written outside the ring
+    for (int i = 0; i < n; ++i, ++tail) {
+        unsigned idx = tail & *ring.sq_mask;
+        struct io_uring_sqe *sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = fd;
+        sqe->off = ios[i].off;
+        sqe->user_data = i;
+        if (ios[i].op == IO_SYNC) {
+            // a data sync of the whole file, as sync_file_range() would leave
+            // the metadata and the device cache, one for a run of syncs; the
+            // ring completes out of order, so it drains what came before it
+            // and holds back what comes after
+            sqe->opcode = synced ? IORING_OP_NOP : IORING_OP_FSYNC;
+            sqe->flags = IOSQE_IO_DRAIN;
+            sqe->off = 0;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            synced = 1;
+            has_sync = 1;
+        } else if (ios[i].op == IO_DISCARD) {
+            // fallocate takes the length in addr and the mode in len
+            sqe->opcode = IORING_OP_FALLOCATE;
+            sqe->addr = ios[i].len;
+            sqe->len = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+            synced = 0;
+        } else {
+            sqe->opcode = ios[i].op == IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->addr = (uintptr_t)ios[i].buf;
+            sqe->len = ios[i].len;
+            synced &= ios[i].op == IO_READ;
+        }
+        ring.sq_array[idx] = idx;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    int submitted = 0;
+    while (submitted < n) {
+        int ret = syscall(__NR_io_uring_enter, ring.fd, n - submitted, n - submitted, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0) return -1;
+        submitted += ret;
+    }
+
+    int ret = 0, reaped = 0;
+    while (reaped < n) {
+        unsigned head = *ring.cq_head;
+        if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            continue;
+        }
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        disk_io *io = &ios[cqe->user_data];
+        if (cqe->res == -EOPNOTSUPP && io->op == IO_DISCARD) {
+            if (zero_range(io->off, io->len)) ret = -1;
+            patched = 1;
+        } else if (cqe->res < 0) {
+            ret = -1;
+        } else if ((io->op == IO_READ || io->op == IO_WRITE) && cqe->res < io->len) {
+            // short transfer, finish the rest synchronously
+            if (finish_io(io->op, io->off + cqe->res, io->len - cqe->res, io->buf + cqe->res)) ret = -1;
+            patched |= io->op == IO_WRITE;
+        }
+        __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+        ++reaped;
+    }
+    // the ring's sync may have run before these, make them durable too
+    if (has_sync && patched && fdatasync(fd)) ret = -1;
+    return ret;
+}
+
+static int uring_submit(disk_io *ios, int n) {
+    if (fallback) return pread_backend.submit(ios, n);
+    int ret = 0;
+    pthread_mutex_lock(&ring_lock);
+    for (int i = 0; i < n; i += QDEPTH) {
+        if (ring_batch(ios + i, n - i < QDEPTH ? n - i : QDEPTH)) ret = -1;
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return ret;
+}
+
+static void uring_close() {
+    if (fallback) {
+        pread_backend.close();
+        fallback = 0;
+        return;
+    }
+    ring_teardown();
+    if (fd >= 0) {
+        fdatasync(fd);
+        close(fd);
+        fd = -1;
+    }
+}
+
+backend uring_backend = {
+    .name = "uring",
+    .open = uring_open,
+    .submit = uring_submit,
+    .close = uring_close,
+};
@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "bds_proto.h"
 #include "tcp_utils.h"
 
 int main(int argc, char *argv[]) {
@@ -14,7 +15,8 @@ int main(int argc, char *argv[]) {
     }
     int port = atoi(argv[1]);
     tcp_client client = client_init("localhost", port);
-    static char buf[4096];
+    // big enough for the reply to a full RV
+    static char buf[BDS_MAXSEC * BDS_SECSIZE + 64];
     while (1) {
         fgets(buf, sizeof(buf), stdin);
         if (feof(stdin)) break;
@@ -1,18 +1,96 @@
 #include "disk.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdint.h>
 
+#include "backend.h"
+#include "bds_proto.h"
+#include "diskstats.h"
+#include "hddmodel.h"
 #include "log.h"
 
 // global variables
 int _ncyl, _nsec, _ttd;
-char *diskfile;
+
+static backend *backends[] = {&mmap_backend, &pread_backend, &uring_backend};
+static backend *be = &mmap_backend;
+static int _direct;
+
+static int _timing = TIMING_LINEAR, _rpm = 7200, _virtual;
+static double _full_ms;
+
+// deferred syncs, one dirty bit per DIRTY_UNIT bytes of the image
+#define DIRTY_UNIT 4096
+static int _durability = DUR_SYNC, _interval = 10, _nwrites = 64;
+static long npages, pending;
+static uint8_t *dirty;
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dirty_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher;
+static int flusher_running;
+
+// one bit per sector discarded since it was last written, these read as
+// zeros without going to the image
+static uint8_t *discarded;
+static pthread_mutex_t discard_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *flusher_main(void *arg);
+
+int parse_durability(const char *arg, int *mode, int *interval, int *nwrites) {
+    if (strcmp(arg, "sync") == 0) {
+        *mode = DUR_SYNC;
+    } else if (strcmp(arg, "writeback") == 0) {
+        *mode = DUR_WRITEBACK;
+    } else if (strncmp(arg, "group", 5) == 0 && (arg[5] == 0 || arg[5] == ':')) {
+        int ms = *interval, writes = *nwrites, end = 0;
+        // the numbers given and nothing after them
+        if (arg[5] == ':' && (sscanf(arg + 6, "%d%n:%d%n", &ms, &end, &writes, &end) < 1 || arg[6 + end]))
+            return -1;
+        if (ms <= 0 || writes <= 0) return -1;
+        *mode = DUR_GROUP;
+        *interval = ms;
+        *nwrites = writes;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int set_backend(const char *spec) {
+    int len = strcspn(spec, ":");
+    int direct = 0;
+    if (spec[len] == ':') {
+        if (strcmp(spec + len + 1, "direct") != 0) return -1;
+        direct = 1;
+    }
+    for (int i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i)
+        if (strlen(backends[i]->name) == len && strncmp(spec, backends[i]->name, len) == 0) {
+            be = backends[i];
+            _direct = direct;
+            return 0;
+        }
+    return -1;
+}
+
+int set_timing(const char *spec, int virtual_clock) {
+    if (spec && hdd_parse(spec, &_timing, &_rpm, &_full_ms) < 0) return -1;
+    _virtual = virtual_clock;
+    return 0;
+}
+
+void set_durability(int mode, int interval, int nwrites) {
+    _durability = mode;
+    _interval = interval;
+    _nwrites = nwrites;
+}
 
 int init_disk(char *filename, int ncyl, int nsec, int ttd) {
     // do some initialization...
@@ -31,8 +109,8 @@ int init_disk(char *filename, int ncyl, int nsec, int ttd) {
         return -1;
     }
     // stretch the file
-    long FILESIZE = BLOCKSIZE * _nsec * _ncyl;
-    int result = lseek(fd, FILESIZE-1, SEEK_SET);
+    long FILESIZE = (long)BLOCKSIZE * _nsec * _ncyl;
+    off_t result = lseek(fd, FILESIZE-1, SEEK_SET);
     if(result == -1){
         Log("Error calling lseek() to 'stretch' the file");
         close(fd);
@@ -44,27 +122,64 @@ int init_disk(char *filename, int ncyl, int nsec, int ttd) {
         close(fd);
         return -1;
     }
-    // mmap
-    diskfile = (char *) mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    // printf("Initialled %p\n", diskfile);
-    if(diskfile == MAP_FAILED){
-        close(fd);
-        Log("Error: Could not map file.\n");
+    if(be->open(fd, filename, FILESIZE, _direct) != 0){
+        Log("Error: Could not open '%s' with the %s backend", filename, be->name);
         return -1;
     }
-    close(fd);
-    Log("Disk initialized: %s, %d Cylinders, %d Sectors per cylinder", filename, ncyl, nsec);
+
+    hdd_init(_timing, ncyl, nsec, ttd, _rpm, _full_ms, _virtual);
+    stats_init(ncyl);
+
+    npages = (FILESIZE + DIRTY_UNIT - 1) / DIRTY_UNIT;
+    dirty = calloc((npages + 7) / 8, 1);
+    pending = 0;
+    discarded = calloc(((long)ncyl * nsec + 7) / 8, 1);
+    if(_durability == DUR_GROUP){
+        flusher_running = 1;
+        pthread_create(&flusher, NULL, flusher_main, NULL);
+    }
+    Log("Disk initialized: %s, %d Cylinders, %d Sectors per cylinder, %s backend%s", filename, ncyl, nsec,
+        be->name, _direct ? " (O_DIRECT)" : "");
     return 0;
 }
 
-void delay(int cyl){
-    static int curr_cyl;
-    usleep(1000 * _ttd * abs(curr_cyl - cyl));
-    curr_cyl = cyl;
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// a request finished, model is what the timing model charged and the
+// backend work started at t0
+static void account(int op, int cyl, int n, double model, double t0) {
+    stats_delay(model);
+    stats_access(op, cyl, n, model + now_ms() - t0);
+}
+
+// set or clear the discarded bits of sectors [first, first + n)
+static void mark_discarded(long first, int n, int on) {
+    pthread_mutex_lock(&discard_lock);
+    for (long i = first; i < first + n; ++i) {
+        if (on)
+            discarded[i / 8] |= 1 << (i % 8);
+        else
+            discarded[i / 8] &= ~(1 << (i % 8));
+    }
+    pthread_mutex_unlock(&discard_lock);
+}
+
+// every sector of [first, first + n) is discarded
+static int all_discarded(long first, int n) {
+    int ret = 1;
+    pthread_mutex_lock(&discard_lock);
+    for (long i = first; i < first + n && ret; ++i)
+        if (!(discarded[i / 8] & (1 << (i % 8)))) ret = 0;
+    pthread_mutex_unlock(&discard_lock);
+    return ret;
 }
 
 // all cmd functions return 0 on success
-int cmd_i(int *ncyl, int *nsec) {
+int disk_cmd_i(int *ncyl, int *nsec) {
     // get the disk info
     *ncyl = _ncyl;
     *nsec = _nsec;
@@ -72,20 +187,95 @@ int cmd_i(int *ncyl, int *nsec) {
     return 0;
 }
 
-int cmd_r(int cyl, int sec, char *buf) {
+int disk_cmd_r(int cyl, int sec, char *buf) {
     // read data from disk, store it in buf
     if (cyl >= _ncyl || sec >= _nsec || cyl < 0 || sec < 0) {
         Log("Invalid cylinder or sector");
         return 1;
     }
-    delay(cyl);
     int n = cyl * _nsec + sec;
-    memcpy(buf, diskfile + BLOCKSIZE * n, BLOCKSIZE);
+    if (all_discarded(n, 1)) {
+        memset(buf, 0, BLOCKSIZE);
+        account(STAT_READ, cyl, 1, 0, now_ms());
+        return 0;
+    }
+    double model = hdd_access(cyl, sec, 1), t0 = now_ms();
+    disk_io io = {IO_READ, (long)BLOCKSIZE * n, BLOCKSIZE, buf};
+    int ret = be->submit(&io, 1) != 0;
+    account(STAT_READ, cyl, 1, model, t0);
+    return ret;
+}
+
+// sync every dirty unit, one batch with a sync per run of units
+static int flush_dirty() {
+    pthread_mutex_lock(&flush_lock);
+    long nbytes = (npages + 7) / 8;
+    uint8_t *snap = malloc(nbytes);
+    pthread_mutex_lock(&dirty_lock);
+    memcpy(snap, dirty, nbytes);
+    memset(dirty, 0, nbytes);
+    pending = 0;
+    pthread_mutex_unlock(&dirty_lock);
+
+    int n = 0, cap = 16;
+    disk_io *ios = malloc(cap * sizeof(disk_io));
+    for (long i = 0; i < npages; ++i) {
+        if (!(snap[i / 8] & (1 << (i % 8)))) continue;
+        long j = i + 1;
+        while (j < npages && (snap[j / 8] & (1 << (j % 8)))) ++j;
+        if (n == cap) ios = realloc(ios, (cap *= 2) * sizeof(disk_io));
+        ios[n++] = (disk_io){IO_SYNC, i * DIRTY_UNIT, (j - i) * DIRTY_UNIT, NULL};
+        i = j;
+    }
+    int ret = 0;
+    if (n > 0) {
+        double t0 = now_ms();
+        ret = be->submit(ios, n);
+        stats_sync(now_ms() - t0);
+    }
+    free(ios);
+    free(snap);
+    pthread_mutex_unlock(&flush_lock);
+    return ret;
+}
+
+// a write landed in [off, off + len), make it durable per the mode
+static int written(long off, long len) {
+    if (_durability == DUR_SYNC) {
+        disk_io io = {IO_SYNC, off, len, NULL};
+        double t0 = now_ms();
+        int ret = be->submit(&io, 1);
+        stats_sync(now_ms() - t0);
+        return ret;
+    }
+    long first = off / DIRTY_UNIT, last = (off + len - 1) / DIRTY_UNIT;
+    pthread_mutex_lock(&dirty_lock);
+    for (long i = first; i <= last; ++i) dirty[i / 8] |= 1 << (i % 8);
+    if (++pending >= _nwrites && _durability == DUR_GROUP) pthread_cond_signal(&dirty_cond);
+    pthread_mutex_unlock(&dirty_lock);
     return 0;
 }
 
-int cmd_w(int cyl, int sec, int len, char *data) {
-    static long sys_pagesize = 0;
+static void *flusher_main(void *arg) {
+    pthread_mutex_lock(&dirty_lock);
+    while (flusher_running) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)_interval * 1000000;
+        ts.tv_sec += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+        while (flusher_running && pending < _nwrites)
+            if (pthread_cond_timedwait(&dirty_cond, &dirty_lock, &ts) == ETIMEDOUT) break;
+        if (pending == 0) continue;
+        pthread_mutex_unlock(&dirty_lock);
+        flush_dirty();
+        pthread_mutex_lock(&dirty_lock);
+    }
+    pthread_mutex_unlock(&dirty_lock);
+    return NULL;
+}
+
+int disk_cmd_w(int cyl, int sec, int len, char *data) {
     // write data to disk
     if (cyl >= _ncyl || sec >= _nsec || cyl < 0 || sec < 0) {
         Log("Invalid cylinder or sector");
@@ -95,30 +285,89 @@ int cmd_w(int cyl, int sec, int len, char *data) {
         Log("Too long data");
         return 1;
     }
-    delay(cyl);
+    double model = hdd_access(cyl, sec, 1), t0 = now_ms();
     int n = cyl * _nsec + sec;
-    // printf("%d %p\n", n, diskfile);
-    char *disk_addr = diskfile + BLOCKSIZE * n;
-    memcpy(disk_addr, data, len);
+    disk_io io = {IO_WRITE, (long)BLOCKSIZE * n, len, data};
+    int ret = be->submit(&io, 1) != 0 || written(io.off, len) == -1;
+    mark_discarded(n, 1, 0);
+    account(STAT_WRITE, cyl, 1, model, t0);
+    return ret;
+}
 
-    if(sys_pagesize == 0) sys_pagesize = sysconf(_SC_PAGESIZE);
-    if(sys_pagesize == -1) sys_pagesize = 4096;
+// check a range of at most max sectors
+static int check_range(int cyl, int sec, int n, int max) {
+    if (cyl >= _ncyl || sec >= _nsec || cyl < 0 || sec < 0) {
+        Log("Invalid cylinder or sector");
+        return 1;
+    }
+    if (n <= 0 || n > max || (long)cyl * _nsec + sec + n > (long)_ncyl * _nsec) {
+        Log("Invalid sector count %d", n);
+        return 1;
+    }
+    return 0;
+}
 
-    char *mapped_end = diskfile + (BLOCKSIZE * _ncyl * _nsec);
-    char *sync_start = (char *)((uintptr_t)disk_addr & ~(sys_pagesize - 1));
-    size_t sync_length = (sync_start + 2 * sys_pagesize) > mapped_end ? (mapped_end - sync_start) : 2 * sys_pagesize;
-    if(msync(sync_start, sync_length, MS_SYNC) == -1) return 1;
+int disk_cmd_rv(int cyl, int sec, int n, char *buf) {
+    if (check_range(cyl, sec, n, BDS_MAXSEC)) return 1;
+    if (all_discarded((long)cyl * _nsec + sec, n)) {
+        memset(buf, 0, (long)BLOCKSIZE * n);
+        account(STAT_READ, cyl, n, 0, now_ms());
+        return 0;
+    }
+    double model = hdd_access(cyl, sec, n), t0 = now_ms();
+    disk_io io = {IO_READ, (long)BLOCKSIZE * (cyl * _nsec + sec), (long)BLOCKSIZE * n, buf};
+    int ret = be->submit(&io, 1) != 0;
+    account(STAT_READ, cyl, n, model, t0);
+    return ret;
+}
+
+int disk_cmd_wv(int cyl, int sec, int n, char *data) {
+    if (check_range(cyl, sec, n, BDS_MAXSEC)) return 1;
+    double model = hdd_access(cyl, sec, n), t0 = now_ms();
+    disk_io io = {IO_WRITE, (long)BLOCKSIZE * (cyl * _nsec + sec), (long)BLOCKSIZE * n, data};
+    int ret = be->submit(&io, 1) != 0 || written(io.off, io.len) == -1;
+    mark_discarded((long)cyl * _nsec + sec, n, 0);
+    account(STAT_WRITE, cyl, n, model, t0);
+    return ret;
+}
+
+int disk_cmd_d(int cyl, int sec, int n) {
+    if (check_range(cyl, sec, n, BDS_MAXDISCARD)) return 1;
+    long first = (long)cyl * _nsec + sec;
+    // as with a write, the image first and the bits after, the caller keeps
+    // reads and writes of the range out meanwhile (sched_enter() in BDS)
+    disk_io io = {IO_DISCARD, BLOCKSIZE * first, (long)BLOCKSIZE * n, NULL};
+    if (be->submit(&io, 1) != 0) return 1;
+    mark_discarded(first, n, 1);
+    return 0;
+}
+
+int disk_cmd_s(char *buf, int size, int reset) {
+    stats_format(buf, size);
+    if (reset) stats_reset();
     return 0;
 }
 
+int disk_cmd_f() {
+    if (_durability == DUR_SYNC) return 0;  // nothing is ever deferred
+    return flush_dirty() == -1;
+}
+
 void close_disk() {
-    // close the file
-    if (diskfile != NULL && diskfile != MAP_FAILED) {
-        long FILESIZE = BLOCKSIZE * _ncyl * _nsec;
-        msync(diskfile, FILESIZE, MS_SYNC);
-        if(munmap(diskfile, FILESIZE) == -1){
-            Log("Error: Munmap failed.");
-        }
-        diskfile = NULL;
+    if (flusher_running) {
+        pthread_mutex_lock(&dirty_lock);
+        flusher_running = 0;
+        pthread_cond_signal(&dirty_cond);
+        pthread_mutex_unlock(&dirty_lock);
+        pthread_join(flusher, NULL);
     }
+    // flush what is still deferred, then let the backend close the file
+    if (dirty != NULL) flush_dirty();
+    be->close();
+    hdd_report();
+    stats_periodic(0);
+    free(dirty);
+    dirty = NULL;
+    free(discarded);
+    discarded = NULL;
 }
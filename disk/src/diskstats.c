@@ -0,0 +1,191 @@
+#include "diskstats.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+// service times go into log-scale buckets, 8 per power of two microseconds
+#define LAT_STEPS 8
+#define LAT_BUCKETS (LAT_STEPS * 32)
+// cylinders are grouped into at most this many bands in the report
+#define HEAT_BANDS 32
+
+static struct {
+    pthread_mutex_t lock;
+    int ncyl;
+    int last_cyl;
+    long nreq[2], nsect[2];
+    long *heat;  // accesses per cylinder
+    long seek[STAT_SEEK_BUCKETS];
+    long lat[LAT_BUCKETS];
+    double delay_ms, sync_ms;
+    long nsync;
+} st = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_t dumper;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dump_cond = PTHREAD_COND_INITIALIZER;
+static int dump_interval;
+
+static void clear() {
+    st.last_cyl = 0;
+    memset(st.nreq, 0, sizeof(st.nreq));
+    memset(st.nsect, 0, sizeof(st.nsect));
+    if (st.heat) memset(st.heat, 0, st.ncyl * sizeof(long));
+    memset(st.seek, 0, sizeof(st.seek));
+    memset(st.lat, 0, sizeof(st.lat));
+    st.delay_ms = st.sync_ms = 0;
+    st.nsync = 0;
+}
+
+void stats_init(int ncyl) {
+    pthread_mutex_lock(&st.lock);
+    free(st.heat);
+    st.ncyl = ncyl > 0 ? ncyl : 1;
+    st.heat = calloc(st.ncyl, sizeof(long));
+    clear();
+    pthread_mutex_unlock(&st.lock);
+}
+
+void stats_reset() {
+    pthread_mutex_lock(&st.lock);
+    clear();
+    pthread_mutex_unlock(&st.lock);
+}
+
+int stats_seek_bucket(int distance) {
+    int b = 0;
+    while (distance > 0 && b < STAT_SEEK_BUCKETS - 1) {
+        distance >>= 1;
+        ++b;
+    }
+    return b;
+}
+
+static int lat_bucket(double ms) {
+    int b = log2(ms * 1000 + 1) * LAT_STEPS;
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+void stats_access(int op, int cyl, int n, double service_ms) {
+    pthread_mutex_lock(&st.lock);
+    st.nreq[op]++;
+    st.nsect[op] += n;
+    if (st.heat && cyl >= 0 && cyl < st.ncyl) st.heat[cyl]++;
+    st.seek[stats_seek_bucket(abs(cyl - st.last_cyl))]++;
+    st.last_cyl = cyl;
+    st.lat[lat_bucket(service_ms)]++;
+    pthread_mutex_unlock(&st.lock);
+}
+
+void stats_delay(double ms) {
+    pthread_mutex_lock(&st.lock);
+    st.delay_ms += ms;
+    pthread_mutex_unlock(&st.lock);
+}
+
+void stats_sync(double ms) {
+    pthread_mutex_lock(&st.lock);
+    st.sync_ms += ms;
+    st.nsync++;
+    pthread_mutex_unlock(&st.lock);
+}
+
+// called with the lock held
+static double percentile(double q) {
+    long total = 0;
+    for (int i = 0; i < LAT_BUCKETS; ++i) total += st.lat[i];
+    if (total == 0) return 0;
+    long want = ceil(q * total), seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; ++i) {
+        seen += st.lat[i];
+        // upper edge of the bucket
+        if (seen >= want) return (exp2((i + 1) / (double)LAT_STEPS) - 1) / 1000;
+    }
+    return 0;
+}
+
+double stats_percentile(double q) {
+    pthread_mutex_lock(&st.lock);
+    double ms = percentile(q);
+    pthread_mutex_unlock(&st.lock);
+    return ms;
+}
+
+// append to buf like snprintf, never past size
+static void append(char *buf, int size, int *len, const char *fmt, ...) {
+    if (*len >= size - 1) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    *len = *len + n < size ? *len + n : size - 1;
+}
+
+int stats_format(char *buf, int size) {
+    int len = 0;
+    buf[0] = 0;
+    pthread_mutex_lock(&st.lock);
+    append(buf, size, &len, "reads %ld (%ld bytes), writes %ld (%ld bytes)\n", st.nreq[STAT_READ],
+           st.nsect[STAT_READ] * 512, st.nreq[STAT_WRITE], st.nsect[STAT_WRITE] * 512);
+    append(buf, size, &len, "delay %.1f ms, sync %.1f ms in %ld syncs\n", st.delay_ms, st.sync_ms, st.nsync);
+    append(buf, size, &len, "service p50 %.3f ms, p99 %.3f ms, p999 %.3f ms\n", percentile(0.5),
+           percentile(0.99), percentile(0.999));
+
+    append(buf, size, &len, "seek distance:");
+    for (int b = 0; b < STAT_SEEK_BUCKETS; ++b) {
+        if (!st.seek[b]) continue;
+        if (b <= 1)
+            append(buf, size, &len, " %d:%ld", b, st.seek[b]);
+        else
+            append(buf, size, &len, " %d-%d:%ld", 1 << (b - 1), (1 << b) - 1, st.seek[b]);
+    }
+    append(buf, size, &len, "\n");
+
+    int bands = st.ncyl < HEAT_BANDS ? st.ncyl : HEAT_BANDS;
+    int width = (st.ncyl + bands - 1) / bands;
+    append(buf, size, &len, "cylinders (%d per band):", width);
+    for (int c = 0; c < st.ncyl; c += width) {
+        long sum = 0;
+        for (int i = c; i < c + width && i < st.ncyl; ++i) sum += st.heat ? st.heat[i] : 0;
+        append(buf, size, &len, " %ld", sum);
+    }
+    append(buf, size, &len, "\n");
+    pthread_mutex_unlock(&st.lock);
+    return len;
+}
+
+static void *dumper_main(void *arg) {
+    static char buf[4096];
+    pthread_mutex_lock(&dump_lock);
+    while (dump_interval > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += dump_interval;
+        pthread_cond_timedwait(&dump_cond, &dump_lock, &ts);
+        if (dump_interval <= 0) break;
+        stats_format(buf, sizeof(buf));
+        Log("Disk stats:\n%s", buf);
+    }
+    pthread_mutex_unlock(&dump_lock);
+    return NULL;
+}
+
+void stats_periodic(int interval_s) {
+    pthread_mutex_lock(&dump_lock);
+    int running = dump_interval > 0;
+    dump_interval = 0;
+    pthread_cond_signal(&dump_cond);
+    pthread_mutex_unlock(&dump_lock);
+    if (running) pthread_join(dumper, NULL);
+    dump_interval = interval_s;  // no dumper left to race with
+    if (interval_s > 0) pthread_create(&dumper, NULL, dumper_main, NULL);
+}
@@ -0,0 +1,146 @@
+#include "hddmodel.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static const char *names[] = {"linear", "hdd"};
+
+static struct {
+    pthread_mutex_t lock;
+    int model;
+    int ncyl, nsec;
+    double t2t_ms, full_ms;
+    double rev_ms, sector_ms;  // one revolution, one sector passing under the head
+    int virtual_clock;
+    double clock;  // ms, simulated with a virtual clock
+    int head;
+    long nreq, nsect;
+    double seek_ms, rot_ms, xfer_ms;
+} h = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+int hdd_parse(const char *spec, int *model, int *rpm, double *full_ms) {
+    if (strcmp(spec, "linear") == 0) {
+        *model = TIMING_LINEAR;
+        return 0;
+    }
+    if (strncmp(spec, "hdd", 3) != 0 || (spec[3] != 0 && spec[3] != ':')) return -1;
+    *model = TIMING_HDD;
+    if (spec[3] == ':') {
+        // "rpm" or "rpm:ms", all of it, or the spec is rejected
+        const char *p = spec + 4;
+        int n = 0;
+        if (sscanf(p, "%d%n", rpm, &n) != 1) return -1;
+        p += n;
+        if (*p == ':') {
+            n = 0;
+            if (sscanf(p + 1, "%lf%n", full_ms, &n) != 1) return -1;
+            p += 1 + n;
+        }
+        if (*p != 0) return -1;
+    }
+    if (*rpm <= 0 || *full_ms < 0) return -1;
+    return 0;
+}
+
+static double wall_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void hdd_init(int model, int ncyl, int nsec, double t2t_ms, int rpm, double full_ms, int virtual_clock) {
+    pthread_mutex_lock(&h.lock);
+    h.model = model;
+    h.ncyl = ncyl;
+    h.nsec = nsec > 0 ? nsec : 1;
+    h.t2t_ms = t2t_ms;
+    // no full stroke given, keep the ratio of a typical drive (about 1 ms / 20 ms)
+    h.full_ms = full_ms > 0 ? full_ms : 20 * t2t_ms;
+    if (h.full_ms < h.t2t_ms) h.full_ms = h.t2t_ms;
+    h.rev_ms = 60000.0 / (rpm > 0 ? rpm : 7200);
+    h.sector_ms = h.rev_ms / h.nsec;
+    h.virtual_clock = virtual_clock;
+    h.clock = 0;
+    h.head = 0;
+    h.nreq = h.nsect = 0;
+    h.seek_ms = h.rot_ms = h.xfer_ms = 0;
+    pthread_mutex_unlock(&h.lock);
+    if (model == TIMING_HDD)
+        Log("Timing: hdd, %.0f rpm, seek %.2f-%.2f ms, %s clock", 60000.0 / h.rev_ms, h.t2t_ms, h.full_ms,
+            virtual_clock ? "virtual" : "real");
+    else
+        Log("Timing: linear, %.2f ms per cylinder, %s clock", t2t_ms, virtual_clock ? "virtual" : "real");
+}
+
+double hdd_seek_time(int distance) {
+    if (distance <= 0) return 0;
+    if (h.model == TIMING_LINEAR) return h.t2t_ms * distance;
+    // the arm accelerates over short seeks and coasts over long ones,
+    // so seek time grows with the square root of the distance
+    if (h.ncyl <= 2) return h.t2t_ms;
+    return h.t2t_ms + (h.full_ms - h.t2t_ms) * sqrt((distance - 1) / (double)(h.ncyl - 2));
+}
+
+double hdd_access(int cyl, int sec, int n) {
+    pthread_mutex_lock(&h.lock);
+    // every cylinder boundary crossed during the transfer is a track-to-track step
+    int crossings = (sec + n - 1) / h.nsec;
+    double seek = hdd_seek_time(abs(cyl - h.head)) + crossings * hdd_seek_time(1);
+    double rot = 0, xfer = 0;
+    if (h.model == TIMING_HDD) {
+        double start = h.virtual_clock ? h.clock : wall_ms();
+        // sector under the head once the seek is done, then wait for ours to come round
+        double pos = fmod(start + seek, h.rev_ms) / h.sector_ms;
+        rot = fmod(sec - pos + h.nsec, h.nsec) * h.sector_ms;
+        xfer = n * h.sector_ms;
+    }
+    double total = seek + rot + xfer;
+    h.head = cyl + crossings;
+    h.clock += total;
+    h.nreq++;
+    h.nsect += n;
+    h.seek_ms += seek;
+    h.rot_ms += rot;
+    h.xfer_ms += xfer;
+    int sleep = !h.virtual_clock;
+    pthread_mutex_unlock(&h.lock);
+    if (sleep && total > 0) usleep(total * 1000);
+    return total;
+}
+
+double hdd_now() {
+    pthread_mutex_lock(&h.lock);
+    double now = h.clock;
+    pthread_mutex_unlock(&h.lock);
+    return now;
+}
+
+void hdd_stats(long *nreq, long *nsect, double *seek_ms, double *rot_ms, double *xfer_ms) {
+    pthread_mutex_lock(&h.lock);
+    *nreq = h.nreq;
+    *nsect = h.nsect;
+    *seek_ms = h.seek_ms;
+    *rot_ms = h.rot_ms;
+    *xfer_ms = h.xfer_ms;
+    pthread_mutex_unlock(&h.lock);
+}
+
+void hdd_report() {
+    long nreq, nsect;
+    double seek, rot, xfer;
+    hdd_stats(&nreq, &nsect, &seek, &rot, &xfer);
+    double busy = seek + rot + xfer;
+    Log("Timing %s: %ld requests, %ld sectors, busy %.1f ms (seek %.1f, rotation %.1f, transfer %.1f), "
+        "%.3f ms per request, %.2f MB/s",
+        names[h.model], nreq, nsect, busy, seek, rot, xfer, nreq ? busy / nreq : 0,
+        busy > 0 ? nsect * 512.0 / 1048576 / (busy / 1000) : 0);
+}
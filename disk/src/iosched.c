@@ -0,0 +1,164 @@
+#include "iosched.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define MAXQUEUE 64
+
+static const char *names[] = {"fcfs", "sstf", "scan", "clook"};
+
+// requests waiting for the disk, in arrival order
+typedef struct {
+    int cyl;
+    int ticket;
+} sched_req;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int policy;
+    int busy;          // a request is being serviced
+    int head;          // cylinder of the last serviced request
+    int dir;           // sweep direction for SCAN
+    int last_arrival;  // cylinder of the last request, for the FCFS baseline
+    int next_ticket;
+    long nreq;
+    long seek;
+    long fcfs_seek;
+    int n;
+    sched_req queue[MAXQUEUE];
+} s = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .dir = 1,
+};
+
+int sched_parse(const char *name) {
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if (strcmp(name, names[i]) == 0) return i;
+    return -1;
+}
+
+const char *sched_name(int policy) {
+    if (policy < 0 || policy >= sizeof(names) / sizeof(names[0])) return "unknown";
+    return names[policy];
+}
+
+void sched_init(int policy) {
+    pthread_mutex_lock(&s.lock);
+    s.policy = policy;
+    s.busy = 0;
+    s.head = s.last_arrival = 0;
+    s.dir = 1;
+    s.nreq = s.seek = s.fcfs_seek = 0;
+    s.n = 0;
+    pthread_mutex_unlock(&s.lock);
+    Log("Scheduler: %s", sched_name(policy));
+}
+
+// nearest request in direction dir, -1 if there is none
+static int nearest(int head, int dir, const int *cyls, int n) {
+    int best = -1;
+    for (int i = 0; i < n; ++i) {
+        int d = (cyls[i] - head) * dir;
+        if (d < 0) continue;
+        if (best < 0 || d < (cyls[best] - head) * dir) best = i;
+    }
+    return best;
+}
+
+int sched_pick(int policy, int head, int *dir, const int *cyls, int n) {
+    int best = 0;
+    switch (policy) {
+    case SCHED_SSTF:
+        for (int i = 1; i < n; ++i)
+            if (abs(cyls[i] - head) < abs(cyls[best] - head)) best = i;
+        break;
+    case SCHED_SCAN:
+        best = nearest(head, *dir, cyls, n);
+        if (best < 0) {
+            // nothing left in this direction, turn around
+            *dir = -*dir;
+            best = nearest(head, *dir, cyls, n);
+        }
+        break;
+    case SCHED_CLOOK:
+        best = nearest(head, 1, cyls, n);
+        if (best < 0) {
+            // wrap to the lowest pending cylinder
+            best = 0;
+            for (int i = 1; i < n; ++i)
+                if (cyls[i] < cyls[best]) best = i;
+        }
+        break;
+    default:  // SCHED_FCFS
+        break;
+    }
+    return best;
+}
+
+int sched_choose(const int *cyls, int n) {
+    pthread_mutex_lock(&s.lock);
+    int dir = s.dir;
+    int best = sched_pick(s.policy, s.head, &dir, cyls, n);
+    pthread_mutex_unlock(&s.lock);
+    return best;
+}
+
+// ticket of the request the policy wants next, called with the lock held
+static int chosen() {
+    int cyls[MAXQUEUE];
+    for (int i = 0; i < s.n; ++i) cyls[i] = s.queue[i].cyl;
+    int dir = s.dir;
+    return s.queue[sched_pick(s.policy, s.head, &dir, cyls, s.n)].ticket;
+}
+
+void sched_enter(int cyl) {
+    pthread_mutex_lock(&s.lock);
+    while (s.n == MAXQUEUE) pthread_cond_wait(&s.cond, &s.lock);
+    int ticket = s.next_ticket++;
+    s.queue[s.n].cyl = cyl;
+    s.queue[s.n].ticket = ticket;
+    s.n++;
+    s.fcfs_seek += abs(cyl - s.last_arrival);
+    s.last_arrival = cyl;
+
+    while (s.busy || chosen() != ticket) pthread_cond_wait(&s.cond, &s.lock);
+
+    // take it out of the queue, keeping arrival order
+    int i = 0;
+    while (s.queue[i].ticket != ticket) ++i;
+    memmove(&s.queue[i], &s.queue[i + 1], (s.n - i - 1) * sizeof(sched_req));
+    s.n--;
+    if (s.policy == SCHED_SCAN && cyl != s.head) s.dir = cyl > s.head ? 1 : -1;
+    s.seek += abs(cyl - s.head);
+    s.head = cyl;
+    s.nreq++;
+    s.busy = 1;
+    pthread_mutex_unlock(&s.lock);
+}
+
+void sched_leave() {
+    pthread_mutex_lock(&s.lock);
+    s.busy = 0;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.lock);
+}
+
+void sched_stats(long *nreq, long *seek, long *fcfs_seek) {
+    pthread_mutex_lock(&s.lock);
+    *nreq = s.nreq;
+    *seek = s.seek;
+    *fcfs_seek = s.fcfs_seek;
+    pthread_mutex_unlock(&s.lock);
+}
+
+void sched_report() {
+    long nreq, seek, fcfs_seek;
+    sched_stats(&nreq, &seek, &fcfs_seek);
+    Log("Scheduler %s: %ld requests, seek %ld cylinders, FCFS %ld, saved %ld", sched_name(s.policy), nreq, seek,
+        fcfs_seek, fcfs_seek - seek);
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "bds_proto.h"
 #include "disk.h"
 #include "log.h"
 
@@ -31,7 +32,7 @@ int parse(char *line, char *argv[], int lim) {
 // return a negative value to exit the program
 int handle_i(char *args) {
     int ncyl, nsec;
-    cmd_i(&ncyl, &nsec);
+    disk_cmd_i(&ncyl, &nsec);
     printf("%d %d\n", ncyl, nsec);
     return 0;
 }
@@ -48,8 +49,8 @@ int handle_r(char *args) {
     int sec = atoi(argv[1]);
     char buf[512];
 
-    // Call the cmd_r function
-    if (cmd_r(cyl, sec, buf) == 0) {
+    // Call the disk_cmd_r function
+    if (disk_cmd_r(cyl, sec, buf) == 0) {
         printf("Yes\n");
         for (int i = 0; i < 512; i++) {
             printf("%c", buf[i]);
@@ -74,7 +75,7 @@ int handle_w(char *args) {
     int len = atoi(argv[2]);
     char *data = argv[3];
 
-    if (cmd_w(cyl, sec, len, data) == 0) {
+    if (disk_cmd_w(cyl, sec, len, data) == 0) {
         printf("Yes\n");
     } else {
         printf("No\n");
@@ -82,6 +83,86 @@ int handle_w(char *args) {
     return 0;
 }
 
+int handle_rv(char *args) {
+    // RV c s n
+    ParseArgs(3);
+    if (argc < 3) {
+        printf("No\n");
+        Log("Invalid arguments");
+        return 0;
+    }
+    int cyl = atoi(argv[0]);
+    int sec = atoi(argv[1]);
+    int n = atoi(argv[2]);
+    static char buf[BDS_MAXSEC * BDS_SECSIZE];
+
+    if (disk_cmd_rv(cyl, sec, n, buf) == 0) {
+        printf("Yes\n");
+        for (int i = 0; i < n * BDS_SECSIZE; i++) {
+            printf("%c", buf[i]);
+        }
+        printf("\n");
+    } else {
+        printf("No\n");
+    }
+    return 0;
+}
+
+int handle_wv(char *args) {
+    // WV c s n data, short data is padded with zeros
+    ParseArgs(3);
+    if (argc < 3) {
+        printf("No\n");
+        Log("Invalid arguments");
+        return 0;
+    }
+    int cyl = atoi(argv[0]);
+    int sec = atoi(argv[1]);
+    int n = atoi(argv[2]);
+    static char buf[BDS_MAXSEC * BDS_SECSIZE];
+    memset(buf, 0, sizeof(buf));
+    strncpy(buf, argv[3], sizeof(buf));
+
+    if (disk_cmd_wv(cyl, sec, n, buf) == 0) {
+        printf("Yes\n");
+    } else {
+        printf("No\n");
+    }
+    return 0;
+}
+
+int handle_d(char *args) {
+    // D c s n
+    ParseArgs(3);
+    if (argc < 3) {
+        printf("No\n");
+        Log("Invalid arguments");
+        return 0;
+    }
+    if (disk_cmd_d(atoi(argv[0]), atoi(argv[1]), atoi(argv[2])) == 0) {
+        printf("Yes\n");
+    } else {
+        printf("No\n");
+    }
+    return 0;
+}
+
+int handle_f(char *args) {
+    if (disk_cmd_f() == 0) {
+        printf("Yes\n");
+    } else {
+        printf("No\n");
+    }
+    return 0;
+}
+
+int handle_s(char *args) {
+    static char buf[4096];
+    disk_cmd_s(buf, sizeof(buf), strncmp(args, "reset", 5) == 0);
+    printf("Yes\n%s", buf);
+    return 0;
+}
+
 int handle_e(char *args) {
     printf("Bye!\n");
     Log("Exit disk");
@@ -95,6 +176,11 @@ static struct {
     {"I", handle_i},
     {"R", handle_r},
     {"W", handle_w},
+    {"RV", handle_rv},
+    {"WV", handle_wv},
+    {"D", handle_d},
+    {"F", handle_f},
+    {"S", handle_s},
     {"E", handle_e},
 };
 
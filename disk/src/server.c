@@ -1,23 +1,53 @@
 #include <stdio.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 #include <unistd.h>
 
+#include "bds_proto.h"
 #include "disk.h"
+#include "diskstats.h"
+#include "hddmodel.h"
 #include "log.h"
+#include "iosched.h"
 #include "tcp_utils.h"
 
+// worker threads, one per connection being serviced, so that requests
+// from several clients can queue up in the scheduler
+#define NTHREAD 8
+
+// binary requests received on one connection and not serviced yet
+typedef struct {
+    bds_hdr hdr;  // as received, network byte order
+    char data[BDS_MAXSEC * BDS_SECSIZE];
+} tagged_req;
+
+typedef struct {
+    int n, nfree;
+    tagged_req *pending[BDS_QDEPTH];  // arrival order
+    tagged_req *free[BDS_QDEPTH];
+    tagged_req slots[BDS_QDEPTH];
+} conn_queue;
+
+// geometry for LBA translation, fixed once the disk is open
+static int disk_ncyl, disk_nsec;
+
+// set once a connection switched to binary framing with "B", by client id
+static conn_queue *queues[FD_SETSIZE];
+
 #define ParseArgs(maxargs)          \
     char *argv[maxargs + 1];        \
     int argc = parse(args, argv, maxargs);
 
 int parse(char *line, char *argv[], int lim) {
     int argc = 0;
-    char *p = strtok(line, " ");
+    char *ptr = NULL;
+    char *p = strtok_r(line, " ", &ptr);
     while (p) {
         argv[argc++] = p;
         if (argc >= lim) break;
-        p = strtok(NULL, " ");
+        p = strtok_r(NULL, " ", &ptr);
     }
     if (argc >= lim) {
         argv[argc] = p + strlen(p) + 1;
@@ -30,8 +60,8 @@ int parse(char *line, char *argv[], int lim) {
 int handle_i(tcp_buffer *wb, char *args, int len) {
     Log("Information request");
     int ncyl, nsec;
-    cmd_i(&ncyl, &nsec);
-    static char buf[64];
+    disk_cmd_i(&ncyl, &nsec);
+    char buf[64];
     sprintf(buf, "%d %d", ncyl, nsec);
 
     // including the null terminator
@@ -51,9 +81,12 @@ int handle_r(tcp_buffer *wb, char *args, int len) {
     int cyl = atoi(argv[0]);
     int sec = atoi(argv[1]);
     char buf[512];
-    if (cmd_r(cyl, sec, buf) == 0) {
+    sched_enter(cyl);
+    int ret = disk_cmd_r(cyl, sec, buf);
+    sched_leave();
+    if (ret == 0) {
         reply_with_yes(wb, buf, 512);
-        Log("cyl: %d, sec: %d, data: \n%s", cyl, sec, buf);
+        Log("cyl: %d, sec: %d, data: \n%.*s", cyl, sec, 512, buf);
     } else {
         reply_with_no(wb, NULL, 0);
         Error("Failed to read");
@@ -74,9 +107,12 @@ int handle_w(tcp_buffer *wb, char *args, int len) {
     int sec = atoi(argv[1]);
     int datalen = atoi(argv[2]);
     char *data = argv[3];
-    Log("cly: %d, sec: %d, len: %d, data: \n%s", cyl, sec, datalen, data);
+    Log("cly: %d, sec: %d, len: %d, data: \n%.*s", cyl, sec, datalen, datalen, data);
 
-    if (cmd_w(cyl, sec, datalen, data) == 0) {
+    sched_enter(cyl);
+    int ret = disk_cmd_w(cyl, sec, datalen, data);
+    sched_leave();
+    if (ret == 0) {
         reply_with_yes(wb, NULL, 0);
     } else {
         reply_with_no(wb, NULL, 0);
@@ -85,6 +121,114 @@ int handle_w(tcp_buffer *wb, char *args, int len) {
     return 0;
 }
 
+int handle_rv(tcp_buffer *wb, char *args, int len) {
+    Log("Ranged read request");
+    // RV c s n
+    ParseArgs(3);
+    if (argc < 3) {
+        reply_with_no(wb, NULL, 0);
+        Warn("Invalid arguments");
+        return 0;
+    }
+    int cyl = atoi(argv[0]);
+    int sec = atoi(argv[1]);
+    int n = atoi(argv[2]);
+    static __thread char buf[BDS_MAXSEC * BDS_SECSIZE];
+    sched_enter(cyl);
+    int ret = disk_cmd_rv(cyl, sec, n, buf);
+    sched_leave();
+    if (ret == 0) {
+        reply_with_yes(wb, buf, n * BDS_SECSIZE);
+        Log("cyl: %d, sec: %d, n: %d", cyl, sec, n);
+    } else {
+        reply_with_no(wb, NULL, 0);
+        Error("Failed to read");
+    }
+    return 0;
+}
+
+int handle_wv(tcp_buffer *wb, char *args, int len) {
+    Log("Ranged write request");
+    // WV c s n data
+    ParseArgs(3);
+    if (argc < 3) {
+        reply_with_no(wb, NULL, 0);
+        Warn("Invalid arguments");
+        return 0;
+    }
+    int cyl = atoi(argv[0]);
+    int sec = atoi(argv[1]);
+    int n = atoi(argv[2]);
+    char *data = argv[3];
+    if (n <= 0 || n > BDS_MAXSEC || len - (data - args) < n * BDS_SECSIZE) {
+        reply_with_no(wb, NULL, 0);
+        Warn("Short data for %d sectors", n);
+        return 0;
+    }
+    Log("cyl: %d, sec: %d, n: %d", cyl, sec, n);
+
+    sched_enter(cyl);
+    int ret = disk_cmd_wv(cyl, sec, n, data);
+    sched_leave();
+    if (ret == 0) {
+        reply_with_yes(wb, NULL, 0);
+    } else {
+        reply_with_no(wb, NULL, 0);
+        Error("Failed to write");
+    }
+    return 0;
+}
+
+int handle_d(tcp_buffer *wb, char *args, int len) {
+    Log("Discard request");
+    // D c s n
+    ParseArgs(3);
+    if (argc < 3) {
+        reply_with_no(wb, NULL, 0);
+        Warn("Invalid arguments");
+        return 0;
+    }
+    int cyl = atoi(argv[0]);
+    int sec = atoi(argv[1]);
+    int n = atoi(argv[2]);
+    Log("cyl: %d, sec: %d, n: %d", cyl, sec, n);
+    sched_enter(cyl);
+    int ret = disk_cmd_d(cyl, sec, n);
+    sched_leave();
+    if (ret == 0) {
+        reply_with_yes(wb, NULL, 0);
+    } else {
+        reply_with_no(wb, NULL, 0);
+        Error("Failed to discard");
+    }
+    return 0;
+}
+
+int handle_f(tcp_buffer *wb, char *args, int len) {
+    Log("Flush request");
+    if (disk_cmd_f() == 0) {
+        reply_with_yes(wb, NULL, 0);
+    } else {
+        reply_with_no(wb, NULL, 0);
+        Error("Failed to flush");
+    }
+    return 0;
+}
+
+int handle_s(tcp_buffer *wb, char *args, int len) {
+    static __thread char buf[4096];
+    int reset = len >= 5 && strncmp(args, "reset", 5) == 0;
+    Log("Stats request%s", reset ? ", reset" : "");
+    disk_cmd_s(buf, sizeof(buf), reset);
+    reply_with_yes(wb, buf, strlen(buf));
+    return 0;
+}
+
+int handle_b(tcp_buffer *wb, char *args, int len) {
+    // the reply still goes out as text, the client waits for it
+    return 2;
+}
+
 int handle_e(tcp_buffer *wb, char *args, int len) {
     const char *msg = "Bye!";
     reply(wb, msg, strlen(msg) + 1);
@@ -98,18 +242,147 @@ static struct {
     {"I", handle_i},
     {"R", handle_r},
     {"W", handle_w},
+    {"RV", handle_rv},
+    {"WV", handle_wv},
+    {"D", handle_d},
+    {"F", handle_f},
+    {"S", handle_s},
+    {"B", handle_b},
     {"E", handle_e},
 };
 
 #define NCMD (sizeof(cmd_table) / sizeof(cmd_table[0]))
 
+static void reply_status(tcp_buffer *wb, bds_hdr *req, int status) {
+    bds_hdr res = *req;
+    res.status = htons(status);
+    buffer_append(wb, (char *)&res, sizeof(res));
+}
+
+// check a binary request and queue it, malformed ones are answered at once
+// returns 1 when the queue is full
+static int queue_binary(conn_queue *q, tcp_buffer *wb, char *msg, int len) {
+    bds_hdr *req = (bds_hdr *)msg;
+    if (len < sizeof(bds_hdr) || req->magic != BDS_MAGIC) {
+        Warn("Malformed binary request");
+        bds_hdr bad = {BDS_MAGIC, 0, 0, 0, 0, 0};
+        reply_status(wb, &bad, BDS_EINVAL);
+        return 0;
+    }
+    uint32_t lba = ntohl(req->lba), count = ntohl(req->count);
+    int ranged = req->opcode == BDS_OP_READ || req->opcode == BDS_OP_WRITE;
+    int discard = req->opcode == BDS_OP_DISCARD;
+    if ((ranged && (count == 0 || count > BDS_MAXSEC)) || (discard && (count == 0 || count > BDS_MAXDISCARD)) ||
+        req->opcode < BDS_OP_INFO || req->opcode > BDS_OP_DISCARD ||
+        ((ranged || discard) && (uint64_t)lba + count > (uint64_t)disk_ncyl * disk_nsec) ||
+        (req->opcode == BDS_OP_WRITE && len < sizeof(bds_hdr) + count * BDS_SECSIZE)) {
+        Error("Invalid binary request %d, lba %u, count %u", req->opcode, lba, count);
+        reply_status(wb, req, BDS_EINVAL);
+        return 0;
+    }
+    tagged_req *r = q->free[--q->nfree];
+    r->hdr = *req;
+    if (req->opcode == BDS_OP_WRITE) memcpy(r->data, msg + sizeof(bds_hdr), count * BDS_SECSIZE);
+    q->pending[q->n++] = r;
+    return q->n == BDS_QDEPTH;
+}
+
+// the request changes what its sectors read as
+static int modifies(tagged_req *r) {
+    return r->hdr.opcode == BDS_OP_WRITE || r->hdr.opcode == BDS_OP_DISCARD;
+}
+
+// b arrived after a and must not be serviced before it
+static int depends(tagged_req *a, tagged_req *b) {
+    if (a->hdr.opcode == BDS_OP_FLUSH || b->hdr.opcode == BDS_OP_FLUSH) return 1;
+    if (!modifies(a) && !modifies(b)) return 0;
+    uint32_t alba = ntohl(a->hdr.lba), blba = ntohl(b->hdr.lba);
+    return alba < blba + ntohl(b->hdr.count) && blba < alba + ntohl(a->hdr.count);
+}
+
+// service one queued request, the response header reuses the request header
+static void service_binary(tcp_buffer *wb, tagged_req *r) {
+    static __thread char out[sizeof(bds_hdr) + BDS_MAXSEC * BDS_SECSIZE];
+    bds_hdr *res = (bds_hdr *)out;
+    int outlen = sizeof(bds_hdr);
+    int status = BDS_OK;
+    *res = r->hdr;
+    uint32_t lba = ntohl(r->hdr.lba), count = ntohl(r->hdr.count);
+    int cyl = lba / disk_nsec, sec = lba % disk_nsec;
+
+    // the range was checked when queued, what fails now is the image
+    switch (r->hdr.opcode) {
+    case BDS_OP_INFO:
+        res->lba = htonl(disk_ncyl);
+        res->count = htonl(disk_nsec);
+        break;
+    case BDS_OP_READ:
+        sched_enter(cyl);
+        if (disk_cmd_rv(cyl, sec, count, out + sizeof(bds_hdr)) == 0)
+            outlen += count * BDS_SECSIZE;
+        else
+            status = BDS_EIO;
+        sched_leave();
+        break;
+    case BDS_OP_WRITE:
+        sched_enter(cyl);
+        if (disk_cmd_wv(cyl, sec, count, r->data) != 0) status = BDS_EIO;
+        sched_leave();
+        break;
+    case BDS_OP_FLUSH:
+        if (disk_cmd_f() != 0) status = BDS_EIO;
+        break;
+    case BDS_OP_DISCARD:
+        // serviced alone like a write, so none lands between the punch and the bits
+        sched_enter(cyl);
+        if (disk_cmd_d(cyl, sec, count) != 0) status = BDS_EIO;
+        sched_leave();
+        break;
+    }
+    if (status != BDS_OK) Error("Binary request %d failed, lba %u, count %u", r->hdr.opcode, lba, count);
+    res->status = htons(status);
+    buffer_append(wb, out, outlen);
+}
+
+// service the queued requests of a connection, in the order the scheduler
+// prefers rather than the order they arrived in
+int on_drain(int id, tcp_buffer *wb) {
+    conn_queue *q = queues[id];
+    if (!q) return 0;
+    while (q->n > 0) {
+        // requests that nothing earlier in the queue holds back
+        int cyls[BDS_QDEPTH], idx[BDS_QDEPTH], m = 0;
+        for (int i = 0; i < q->n; ++i) {
+            int ready = 1;
+            for (int j = 0; j < i && ready; ++j)
+                if (depends(q->pending[j], q->pending[i])) ready = 0;
+            if (!ready) continue;
+            cyls[m] = ntohl(q->pending[i]->hdr.lba) / disk_nsec;
+            idx[m++] = i;
+        }
+        int i = idx[sched_choose(cyls, m)];
+        tagged_req *r = q->pending[i];
+        int outlen = sizeof(bds_hdr) + 4;
+        if (r->hdr.opcode == BDS_OP_READ) outlen += ntohl(r->hdr.count) * BDS_SECSIZE;
+        if (TCP_BUF_SIZE - wb->write_index < outlen) break;  // send what we have first
+
+        service_binary(wb, r);
+        memmove(&q->pending[i], &q->pending[i + 1], (q->n - i - 1) * sizeof(tagged_req *));
+        q->n--;
+        q->free[q->nfree++] = r;
+    }
+    return q->n;
+}
+
 void on_connection(int id) {
     // some code that are executed when a new client is connected
-    // you don't need this now
+    queues[id] = NULL;
 }
 
 int on_recv(int id, tcp_buffer *wb, char *msg, int len) {
-    char *p = strtok(msg, " \r\n");
+    if (queues[id]) return queue_binary(queues[id], wb, msg, len);
+    char *ptr = NULL;
+    char *p = strtok_r(msg, " \r\n", &ptr);
     int ret = 1;
     for (int i = 0; i < NCMD; i++)
         if (p && strcmp(p, cmd_table[i].name) == 0) {
@@ -120,6 +393,13 @@ int on_recv(int id, tcp_buffer *wb, char *msg, int len) {
         static char unk[] = "Unknown command";
         buffer_append(wb, unk, sizeof(unk));
     }
+    if (ret == 2) {
+        Log("Client %d switched to binary framing", id);
+        reply_with_yes(wb, NULL, 0);
+        conn_queue *q = calloc(1, sizeof(conn_queue));
+        for (int i = 0; i < BDS_QDEPTH; ++i) q->free[q->nfree++] = &q->slots[i];
+        queues[id] = q;
+    }
     if (ret < 0) {
         return -1;
     }
@@ -128,37 +408,93 @@ int on_recv(int id, tcp_buffer *wb, char *msg, int len) {
 
 void cleanup(int id) {
     // some code that are executed when a client is disconnected
-    // you don't need this now
+    free(queues[id]);
+    queues[id] = NULL;
+    sched_report();
+    hdd_report();
 }
 
 FILE *log_file;
 
 int main(int argc, char *argv[]) {
-    if (argc < 6) {
+    int policy = SCHED_FCFS;
+    int durability = DUR_SYNC, interval = 10, nwrites = 64;
+    char *timing = NULL;
+    int virtual_clock = 0;
+    int stats_interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:b:t:vp:")) != -1) {
+        switch (opt) {
+        case 's':
+            policy = sched_parse(optarg);
+            if (policy < 0) {
+                fprintf(stderr, "Unknown scheduler '%s', use fcfs, sstf, scan or clook\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            if (parse_durability(optarg, &durability, &interval, &nwrites) < 0) {
+                fprintf(stderr, "Unknown durability '%s', use sync, group[:ms[:writes]] or writeback\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            if (set_backend(optarg) < 0) {
+                fprintf(stderr, "Unknown backend '%s', use mmap, pread[:direct] or uring\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            timing = optarg;
+            break;
+        case 'v':
+            virtual_clock = 1;
+            break;
+        case 'p':
+            stats_interval = atoi(optarg);
+            break;
+        default:
+            argc = 0;  // print usage
+        }
+    }
+    if (argc - optind < 5) {
         fprintf(stderr,
-                "Usage: %s <disk file name> <cylinders> <sector per cylinder> "
+                "Usage: %s [-s fcfs|sstf|scan|clook] [-d sync|group[:ms[:writes]]|writeback] "
+                "[-b mmap|pread[:direct]|uring] [-t linear|hdd[:rpm[:full stroke ms]]] [-v] [-p seconds] "
+                "<disk file name> <cylinders> <sector per cylinder> "
                 "<track-to-track delay> <port>\n",
                 argv[0]);
         exit(EXIT_FAILURE);
     }
 
     // args
-    char *filename = argv[1];
-    int ncyl = atoi(argv[2]);
-    int nsec = atoi(argv[3]);
-    int ttd = atoi(argv[4]);  // ms
-    int port = atoi(argv[5]);
+    char *filename = argv[optind];
+    int ncyl = atoi(argv[optind + 1]);
+    int nsec = atoi(argv[optind + 2]);
+    int ttd = atoi(argv[optind + 3]);  // ms
+    int port = atoi(argv[optind + 4]);
 
     log_init("disk.log");
 
+    set_durability(durability, interval, nwrites);
+    if (set_timing(timing, virtual_clock) < 0) {
+        fprintf(stderr, "Unknown timing '%s', use linear or hdd[:rpm[:full stroke ms]]\n", timing);
+        exit(EXIT_FAILURE);
+    }
     int ret = init_disk(filename, ncyl, nsec, ttd);
     if (ret != 0) {
         fprintf(stderr, "Failed to initialize disk\n");
         exit(EXIT_FAILURE);
     }
 
+    sched_init(policy);
+    stats_periodic(stats_interval);
+    disk_ncyl = ncyl;
+    disk_nsec = nsec;
+
     // command
-    tcp_server server = server_init(port, 1, on_connection, on_recv, cleanup);
+    tcp_server server = server_init(port, NTHREAD, on_connection, on_recv, cleanup);
+    server_set_on_drain(server, on_drain);
     server_run(server);
 
     // never reached
@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bds_proto.h"
+#include "disk.h"
+#include "log.h"
+
+// Compare the storage backends on one image: sequential ranged writes,
+// a barrier, then sequential and random reads. The image is dropped from
+// the page cache before each read pass so that cold reads are measured.
+
+static const char *specs[] = {"mmap", "pread", "pread:direct", "uring"};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_cache(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+FILE *log_file;
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <disk file name> <cylinders> <sector per cylinder> [random reads]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    char *filename = argv[1];
+    int ncyl = atoi(argv[2]);
+    int nsec = atoi(argv[3]);
+    int nrand = argc > 4 ? atoi(argv[4]) : 20000;
+    long nsector = (long)ncyl * nsec;
+    double mb = nsector * BDS_SECSIZE / 1048576.0;
+
+    log_init("bench.log");
+    char *buf;
+    if (posix_memalign((void **)&buf, 4096, BDS_MAXSEC * BDS_SECSIZE)) exit(EXIT_FAILURE);
+    memset(buf, 0x5a, BDS_MAXSEC * BDS_SECSIZE);
+
+    printf("%-14s %12s %12s %12s %14s\n", "backend", "seq write", "flush", "seq read", "random read");
+    for (int b = 0; b < sizeof(specs) / sizeof(specs[0]); ++b) {
+        set_backend(specs[b]);
+        set_durability(DUR_WRITEBACK, 10, 64);
+        if (init_disk(filename, ncyl, nsec, 0) != 0) {
+            printf("%-14s failed to open\n", specs[b]);
+            continue;
+        }
+
+        double t0 = now();
+        for (long s = 0; s < nsector; s += BDS_MAXSEC) {
+            int n = nsector - s < BDS_MAXSEC ? nsector - s : BDS_MAXSEC;
+            disk_cmd_wv(s / nsec, s % nsec, n, buf);
+        }
+        double t1 = now();
+        disk_cmd_f();
+        double t2 = now();
+
+        drop_cache(filename);
+        double t3 = now();
+        for (long s = 0; s < nsector; s += BDS_MAXSEC) {
+            int n = nsector - s < BDS_MAXSEC ? nsector - s : BDS_MAXSEC;
+            disk_cmd_rv(s / nsec, s % nsec, n, buf);
+        }
+        double t4 = now();
+
+        drop_cache(filename);
+        srand(1);
+        double t5 = now();
+        for (int i = 0; i < nrand; ++i) {
+            long s = ((long)rand() * RAND_MAX + rand()) % nsector;
+            disk_cmd_r(s / nsec, s % nsec, buf);
+        }
+        double t6 = now();
+        close_disk();
+
+        printf("%-14s %7.1f MB/s %9.1f ms %7.1f MB/s %8.0f IOPS\n", specs[b], mb / (t1 - t0), (t2 - t1) * 1000,
+               mb / (t4 - t3), nrand / (t6 - t5));
+    }
+    free(buf);
+    log_close();
+    return 0;
+}
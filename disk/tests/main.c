@@ -9,8 +9,16 @@ int mt_pass_count = 0;
 int mt_fail_count = 0;
 
 void disk_tests();
+void sched_tests();
+void hdd_tests();
+void stats_tests();
 
-void all_tests() { mt_run_suite(disk_tests); }
+void all_tests() {
+    mt_run_suite(disk_tests);
+    mt_run_suite(sched_tests);
+    mt_run_suite(hdd_tests);
+    mt_run_suite(stats_tests);
+}
 
 FILE *log_file;
 
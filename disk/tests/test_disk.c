@@ -1,7 +1,12 @@
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "backend.h"
 #include "disk.h"
+#include "iosched.h"
 #include "mintest.h"
 
 inline static void setup_disk() { init_disk("test_disk.img", 10, 10, 0); }
@@ -9,7 +14,7 @@ inline static void setup_disk() { init_disk("test_disk.img", 10, 10, 0); }
 mt_test(test_cmd_i) {
     setup_disk();
     int ncyl, nsec;
-    int result = cmd_i(&ncyl, &nsec);
+    int result = disk_cmd_i(&ncyl, &nsec);
     mt_assert(result == 0);
     mt_assert(ncyl == 10);
     mt_assert(nsec == 10);
@@ -27,10 +32,10 @@ mt_test(test_cmd_wr) {
     write_buf[511] = '\0';
 
 
-    int write_result = cmd_w(0, 0, 512, write_buf);
+    int write_result = disk_cmd_w(0, 0, 512, write_buf);
     mt_assert(write_result == 0);
 
-    int read_result = cmd_r(0, 0, read_buf);
+    int read_result = disk_cmd_r(0, 0, read_buf);
     mt_assert(read_result == 0);
     mt_assert(memcmp(write_buf, read_buf, 512) == 0);
     close_disk();
@@ -47,7 +52,7 @@ mt_test(test_wwr) {
     }
     write_buf[511] = '\0';
 
-    int write_result = cmd_w(1, 1, 512, write_buf);
+    int write_result = disk_cmd_w(1, 1, 512, write_buf);
     mt_assert(write_result == 0);
 
     for (int i = 0; i < 512; i++) {
@@ -55,10 +60,10 @@ mt_test(test_wwr) {
     }
     write_buf[511] = '\0';
 
-    write_result = cmd_w(1, 1, 512, write_buf);
+    write_result = disk_cmd_w(1, 1, 512, write_buf);
     mt_assert(write_result == 0);
 
-    int read_result = cmd_r(1, 1, read_buf);
+    int read_result = disk_cmd_r(1, 1, read_buf);
     mt_assert(read_result == 0);
     mt_assert(memcmp(write_buf, read_buf, 512) == 0);
     close_disk();
@@ -71,10 +76,10 @@ mt_test(test_w_partial) {
     char read_buf[512];
     memset(data + 16, 0, sizeof(data) - 16);
 
-    int write_result = cmd_w(2, 2, 16, data);
+    int write_result = disk_cmd_w(2, 2, 16, data);
     mt_assert(write_result == 0);
 
-    int read_result = cmd_r(2, 2, read_buf);
+    int read_result = disk_cmd_r(2, 2, read_buf);
     mt_assert(read_result == 0);
     mt_assert(memcmp(data, read_buf, 512) == 0);
     close_disk();
@@ -90,10 +95,10 @@ mt_test(test_non_ascii) {
         write_buf[i] = 0xFF - (i % 256);
     }
 
-    int write_result = cmd_w(3, 3, 512, write_buf);
+    int write_result = disk_cmd_w(3, 3, 512, write_buf);
     mt_assert(write_result == 0);
 
-    int read_result = cmd_r(3, 3, read_buf);
+    int read_result = disk_cmd_r(3, 3, read_buf);
     mt_assert(read_result == 0);
     mt_assert(memcmp(write_buf, read_buf, 512) == 0);
     close_disk();
@@ -104,24 +109,265 @@ mt_test(test_out_of_bounds) {
     setup_disk();
     char buf[512];
 
-    int read_result = cmd_r(10, 10, buf);
+    int read_result = disk_cmd_r(10, 10, buf);
     mt_assert(read_result != 0);
 
-    read_result = cmd_r(-1, -1, buf);
+    read_result = disk_cmd_r(-1, -1, buf);
     mt_assert(read_result != 0);
 
-    int write_result = cmd_w(10, 10, sizeof(buf), buf);
+    int write_result = disk_cmd_w(10, 10, sizeof(buf), buf);
     mt_assert(write_result != 0);
 
-    write_result = cmd_w(-1, -1, sizeof(buf), buf);
+    write_result = disk_cmd_w(-1, -1, sizeof(buf), buf);
     mt_assert(write_result != 0);
 
-    write_result = cmd_w(0, 0, 666, buf);
+    write_result = disk_cmd_w(0, 0, 666, buf);
     mt_assert(write_result != 0);
     close_disk();
     return 0;
 }
 
+mt_test(test_cmd_rwv) {
+    setup_disk();
+    // 6 sectors starting at the end of cylinder 4, into cylinder 5
+    int n = 6;
+    char *write_buf = malloc(n * 512);
+    char *read_buf = malloc(n * 512);
+    for (int i = 0; i < n * 512; i++) {
+        write_buf[i] = 'a' + (i / 512);
+    }
+
+    mt_assert(disk_cmd_wv(4, 7, n, write_buf) == 0);
+    mt_assert(disk_cmd_rv(4, 7, n, read_buf) == 0);
+    mt_assert(memcmp(write_buf, read_buf, n * 512) == 0);
+
+    // the single sector commands see the same data
+    mt_assert(disk_cmd_r(5, 2, read_buf) == 0);
+    mt_assert(memcmp(write_buf + 5 * 512, read_buf, 512) == 0);
+
+    free(write_buf);
+    free(read_buf);
+    close_disk();
+    return 0;
+}
+
+mt_test(test_rwv_out_of_bounds) {
+    setup_disk();
+    char *buf = malloc(4 * 512);
+    memset(buf, 0, 4 * 512);
+
+    mt_assert(disk_cmd_rv(9, 8, 2, buf) == 0);  // last two sectors
+    mt_assert(disk_cmd_rv(9, 8, 3, buf) != 0);  // past the end
+    mt_assert(disk_cmd_wv(9, 9, 2, buf) != 0);
+    mt_assert(disk_cmd_rv(0, 0, 0, buf) != 0);
+    mt_assert(disk_cmd_wv(0, 0, -1, buf) != 0);
+    mt_assert(disk_cmd_rv(-1, 0, 1, buf) != 0);
+
+    free(buf);
+    close_disk();
+    return 0;
+}
+
+static int reopen_and_check(int cyl, int sec, char *expect) {
+    char read_buf[512];
+    close_disk();
+    setup_disk();
+    int ok = disk_cmd_r(cyl, sec, read_buf) == 0 && memcmp(expect, read_buf, 512) == 0;
+    close_disk();
+    return ok;
+}
+
+mt_test(test_group_commit) {
+    set_durability(DUR_GROUP, 5, 4);
+    setup_disk();
+    char write_buf[512];
+    for (int i = 0; i < 10; i++) {
+        memset(write_buf, 'g' + i, 512);
+        mt_assert(disk_cmd_w(6, i, 512, write_buf) == 0);
+    }
+    mt_assert(disk_cmd_f() == 0);
+    mt_assert(reopen_and_check(6, 9, write_buf));
+    set_durability(DUR_SYNC, 10, 64);
+    return 0;
+}
+
+mt_test(test_writeback) {
+    set_durability(DUR_WRITEBACK, 10, 64);
+    setup_disk();
+    char write_buf[512];
+    memset(write_buf, 'w', 512);
+    mt_assert(disk_cmd_wv(7, 9, 1, write_buf) == 0);
+    mt_assert(disk_cmd_f() == 0);
+    memset(write_buf, 'v', 512);
+    mt_assert(disk_cmd_w(7, 9, 512, write_buf) == 0);
+    // close_disk() syncs what is still pending
+    mt_assert(reopen_and_check(7, 9, write_buf));
+    set_durability(DUR_SYNC, 10, 64);
+    return 0;
+}
+
+mt_test(test_parse_durability) {
+    int mode, interval = 10, nwrites = 64;
+    mt_assert(parse_durability("sync", &mode, &interval, &nwrites) == 0 && mode == DUR_SYNC);
+    mt_assert(parse_durability("writeback", &mode, &interval, &nwrites) == 0 && mode == DUR_WRITEBACK);
+    mt_assert(parse_durability("group", &mode, &interval, &nwrites) == 0 && mode == DUR_GROUP);
+    mt_assert(interval == 10 && nwrites == 64);
+    mt_assert(parse_durability("group:20:8", &mode, &interval, &nwrites) == 0);
+    mt_assert(interval == 20 && nwrites == 8);
+    mt_assert(parse_durability("group:5", &mode, &interval, &nwrites) == 0);
+    mt_assert(interval == 5 && nwrites == 8);
+    mt_assert(parse_durability("group:abc", &mode, &interval, &nwrites) != 0);
+    mt_assert(parse_durability("group:5:", &mode, &interval, &nwrites) != 0);
+    mt_assert(parse_durability("group:5:8x", &mode, &interval, &nwrites) != 0);
+    mt_assert(parse_durability("group:0:8", &mode, &interval, &nwrites) != 0);
+    mt_assert(parse_durability("group:5:-1", &mode, &interval, &nwrites) != 0);
+    mt_assert(interval == 5 && nwrites == 8);  // untouched by what failed
+    mt_assert(parse_durability("groups", &mode, &interval, &nwrites) != 0);
+    mt_assert(parse_durability("async", &mode, &interval, &nwrites) != 0);
+    return 0;
+}
+
+mt_test(test_discard) {
+    setup_disk();
+    char write_buf[4 * 512], read_buf[4 * 512], zero[4 * 512] = {0};
+    memset(write_buf, 'd', sizeof(write_buf));
+    mt_assert(disk_cmd_wv(2, 8, 4, write_buf) == 0);
+    // a discard may cover more than a ranged write, and whole pages of the image
+    mt_assert(disk_cmd_d(0, 0, 100) == 0);
+    mt_assert(disk_cmd_rv(2, 8, 4, read_buf) == 0);
+    mt_assert(memcmp(read_buf, zero, sizeof(zero)) == 0);
+    // writing one sector brings it back, its neighbours stay discarded
+    mt_assert(disk_cmd_w(2, 9, 512, write_buf) == 0);
+    mt_assert(disk_cmd_rv(2, 8, 3, read_buf) == 0);
+    mt_assert(memcmp(read_buf, zero, 512) == 0);
+    mt_assert(memcmp(read_buf + 512, write_buf, 512) == 0);
+    mt_assert(memcmp(read_buf + 1024, zero, 512) == 0);
+    mt_assert(reopen_and_check(3, 0, zero));
+
+    setup_disk();
+    mt_assert(disk_cmd_d(9, 9, 2) != 0);  // past the end
+    mt_assert(disk_cmd_d(0, 0, 0) != 0);
+    close_disk();
+    return 0;
+}
+
+// a discard and writes of the same sectors from other threads, each serviced
+// alone as BDS does, the range always reads as the last one left it
+static int last_fill;  // 0 after a discard, else the byte written
+static volatile int racing;
+
+static void *discard_main(void *arg) {
+    while (racing) {
+        sched_enter(4);
+        disk_cmd_d(4, 0, 20);
+        last_fill = 0;
+        sched_leave();
+    }
+    return NULL;
+}
+
+static void *write_main(void *arg) {
+    char buf[20 * 512];
+    for (int k = 1; racing; k = k % 200 + 1) {
+        memset(buf, k, sizeof(buf));
+        sched_enter(4);
+        disk_cmd_wv(4, 0, 20, buf);
+        last_fill = k;
+        sched_leave();
+    }
+    return NULL;
+}
+
+mt_test(test_discard_write_race) {
+    setup_disk();
+    pthread_t d, w;
+    racing = 1;
+    pthread_create(&d, NULL, discard_main, NULL);
+    pthread_create(&w, NULL, write_main, NULL);
+    char buf[20 * 512], want[20 * 512];
+    int bad = 0;
+    for (int i = 0; i < 500; i++) {
+        sched_enter(4);
+        disk_cmd_rv(4, 0, 20, buf);
+        memset(want, last_fill, sizeof(want));
+        bad += memcmp(buf, want, sizeof(buf)) != 0;
+        sched_leave();
+    }
+    racing = 0;
+    pthread_join(d, NULL);
+    pthread_join(w, NULL);
+    mt_assert(bad == 0);
+    // and the image, in a whole page of it, the bits are gone after reopening
+    memset(want, last_fill, sizeof(want));
+    mt_assert(reopen_and_check(4, 8, want));
+    return 0;
+}
+
+// the same reads and writes through every backend
+static char *backend_rw(const char *spec) {
+    mt_assert(set_backend(spec) == 0);
+    setup_disk();
+    char write_buf[3 * 512], read_buf[3 * 512];
+    for (int i = 0; i < sizeof(write_buf); i++) {
+        write_buf[i] = (char)(i * 13 + spec[0]);
+    }
+    mt_assert(disk_cmd_wv(8, 8, 3, write_buf) == 0);
+    mt_assert(disk_cmd_w(8, 3, 100, write_buf) == 0);  // partial sector
+    mt_assert(disk_cmd_rv(8, 8, 3, read_buf) == 0);
+    mt_assert(memcmp(write_buf, read_buf, sizeof(write_buf)) == 0);
+    mt_assert(disk_cmd_r(8, 3, read_buf) == 0);
+    mt_assert(memcmp(write_buf, read_buf, 100) == 0);
+    mt_assert(reopen_and_check(9, 0, write_buf + 2 * 512));
+    // the discard reaches the image, not just the discarded bitmap
+    char zero[512] = {0};
+    setup_disk();
+    mt_assert(disk_cmd_d(8, 8, 2) == 0);
+    mt_assert(reopen_and_check(8, 9, zero));
+    mt_assert(reopen_and_check(9, 0, write_buf + 2 * 512));
+    mt_assert(set_backend("mmap") == 0);
+    return 0;
+}
+
+mt_test(test_backend_pread) { return backend_rw("pread"); }
+mt_test(test_backend_direct) { return backend_rw("pread:direct"); }
+mt_test(test_backend_uring) { return backend_rw("uring"); }
+
+// writes and syncs in one batch, each sync after the writes before it
+mt_test(test_uring_mixed_batch) {
+    int fd = open("test_batch.img", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    mt_assert(fd >= 0 && ftruncate(fd, 8192) == 0);
+    mt_assert(uring_backend.open(fd, "test_batch.img", 8192, 0) == 0);
+    char a[4096], b[4096], got[4096];
+    memset(a, 'a', sizeof(a));
+    memset(b, 'b', sizeof(b));
+    disk_io ios[] = {
+        {IO_WRITE, 0, sizeof(a), a},
+        {IO_SYNC, 0, 8192, NULL},
+        {IO_WRITE, 4096, sizeof(b), b},
+        {IO_SYNC, 0, 8192, NULL},
+        {IO_READ, 4096, sizeof(got), got},
+    };
+    mt_assert(uring_backend.submit(ios, 5) == 0);
+    mt_assert(memcmp(got, b, sizeof(b)) == 0);
+    uring_backend.close();
+    fd = open("test_batch.img", O_RDONLY);
+    mt_assert(fd >= 0 && pread(fd, got, sizeof(got), 0) == sizeof(got));
+    close(fd);
+    unlink("test_batch.img");
+    mt_assert(memcmp(got, a, sizeof(a)) == 0);
+    return 0;
+}
+
+mt_test(test_set_backend) {
+    mt_assert(set_backend("mmap") == 0);
+    mt_assert(set_backend("uring") == 0);
+    mt_assert(set_backend("pread:direct") == 0);
+    mt_assert(set_backend("pread:sync") != 0);
+    mt_assert(set_backend("aio") != 0);
+    mt_assert(set_backend("mmap") == 0);
+    return 0;
+}
+
 void disk_tests() {
     mt_run_test(test_cmd_i);
     mt_run_test(test_cmd_wr);
@@ -129,4 +375,16 @@ void disk_tests() {
     mt_run_test(test_w_partial);
     mt_run_test(test_non_ascii);
     mt_run_test(test_out_of_bounds);
+    mt_run_test(test_cmd_rwv);
+    mt_run_test(test_rwv_out_of_bounds);
+    mt_run_test(test_discard);
+    mt_run_test(test_discard_write_race);
+    mt_run_test(test_group_commit);
+    mt_run_test(test_writeback);
+    mt_run_test(test_parse_durability);
+    mt_run_test(test_set_backend);
+    mt_run_test(test_backend_pread);
+    mt_run_test(test_backend_direct);
+    mt_run_test(test_backend_uring);
+    mt_run_test(test_uring_mixed_batch);
 }
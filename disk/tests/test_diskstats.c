@@ -0,0 +1,58 @@
+#include <string.h>
+
+#include "diskstats.h"
+#include "mintest.h"
+
+mt_test(test_stats_seek_bucket) {
+    mt_assert(stats_seek_bucket(0) == 0);
+    mt_assert(stats_seek_bucket(1) == 1);
+    mt_assert(stats_seek_bucket(2) == 2);
+    mt_assert(stats_seek_bucket(3) == 2);
+    mt_assert(stats_seek_bucket(4) == 3);
+    mt_assert(stats_seek_bucket(1000) == 10);
+    mt_assert(stats_seek_bucket(1 << 30) == STAT_SEEK_BUCKETS - 1);
+    return 0;
+}
+
+mt_test(test_stats_percentile) {
+    stats_init(100);
+    mt_assert(stats_percentile(0.5) == 0);
+    // 990 fast requests, 9 slow ones and one very slow one
+    for (int i = 0; i < 990; ++i) stats_access(STAT_READ, 0, 1, 0.1);
+    for (int i = 0; i < 9; ++i) stats_access(STAT_READ, 0, 1, 10);
+    stats_access(STAT_WRITE, 0, 1, 1000);
+    // buckets are within 10% of the time they hold
+    double p50 = stats_percentile(0.5), p999 = stats_percentile(0.999), p100 = stats_percentile(1);
+    mt_assert(p50 >= 0.1 && p50 < 0.11);
+    mt_assert(p999 >= 10 && p999 < 11);
+    mt_assert(p100 >= 1000 && p100 < 1100);
+    return 0;
+}
+
+mt_test(test_stats_format) {
+    char buf[4096];
+    stats_init(64);
+    stats_access(STAT_READ, 0, 4, 1);
+    stats_access(STAT_WRITE, 10, 1, 1);
+    stats_access(STAT_READ, 63, 2, 1);
+    stats_sync(2.5);
+    stats_format(buf, sizeof(buf));
+    mt_assert(strstr(buf, "reads 2 (3072 bytes), writes 1 (512 bytes)") != NULL);
+    mt_assert(strstr(buf, "sync 2.5 ms in 1 syncs") != NULL);
+    mt_assert(strstr(buf, "seek distance: 0:1 8-15:1 32-63:1") != NULL);
+    mt_assert(strstr(buf, "cylinders (2 per band): 1 0 0 0 0 1 ") != NULL);
+
+    // a short buffer is cut, not overrun
+    mt_assert(stats_format(buf, 16) == 15 && strlen(buf) == 15);
+
+    stats_reset();
+    stats_format(buf, sizeof(buf));
+    mt_assert(strstr(buf, "reads 0 (0 bytes), writes 0 (0 bytes)") != NULL);
+    return 0;
+}
+
+void stats_tests() {
+    mt_run_test(test_stats_seek_bucket);
+    mt_run_test(test_stats_percentile);
+    mt_run_test(test_stats_format);
+}
@@ -0,0 +1,82 @@
+#include <math.h>
+#include <time.h>
+
+#include "hddmodel.h"
+#include "mintest.h"
+
+#define near(a, b) (fabs((a) - (b)) < 1e-6)
+
+mt_test(test_hdd_parse) {
+    int model = -1, rpm = 7200;
+    double full = 0;
+    mt_assert(hdd_parse("linear", &model, &rpm, &full) == 0 && model == TIMING_LINEAR);
+    mt_assert(hdd_parse("hdd", &model, &rpm, &full) == 0 && model == TIMING_HDD && rpm == 7200);
+    mt_assert(hdd_parse("hdd:5400", &model, &rpm, &full) == 0 && rpm == 5400 && full == 0);
+    mt_assert(hdd_parse("hdd:10000:8.5", &model, &rpm, &full) == 0 && rpm == 10000 && near(full, 8.5));
+    mt_assert(hdd_parse("ssd", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:0", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:abc", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:7200:x", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:7200:", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:7200x", &model, &rpm, &full) == -1);
+    mt_assert(hdd_parse("hdd:7200:8.5ms", &model, &rpm, &full) == -1);
+    return 0;
+}
+
+mt_test(test_hdd_linear) {
+    // the old model, track-to-track delay per cylinder and per boundary crossed
+    hdd_init(TIMING_LINEAR, 100, 10, 2, 7200, 0, 1);
+    mt_assert(near(hdd_access(10, 0, 1), 20));
+    mt_assert(near(hdd_access(10, 5, 1), 0));
+    mt_assert(near(hdd_access(9, 5, 10), 4));
+    mt_assert(near(hdd_now(), 24));
+    return 0;
+}
+
+mt_test(test_hdd_seek_curve) {
+    hdd_init(TIMING_HDD, 1001, 10, 1, 7200, 20, 1);
+    mt_assert(near(hdd_seek_time(0), 0));
+    mt_assert(near(hdd_seek_time(1), 1));
+    mt_assert(near(hdd_seek_time(1000), 20));
+    for (int d = 1; d < 1000; ++d) mt_assert(hdd_seek_time(d) < hdd_seek_time(d + 1));
+    // short seeks cost relatively more than long ones
+    mt_assert(hdd_seek_time(100) > hdd_seek_time(1000) / 10);
+    return 0;
+}
+
+mt_test(test_hdd_rotation) {
+    // 6000 rpm, 10 sectors per track: one sector passes every 1 ms, no seek cost
+    hdd_init(TIMING_HDD, 10, 10, 0, 6000, 0, 1);
+    mt_assert(near(hdd_access(0, 3, 1), 4));  // wait for sector 3, transfer it
+    mt_assert(near(hdd_access(0, 4, 1), 1));  // the next sector is right under the head
+    mt_assert(near(hdd_access(0, 2, 1), 8));  // a whole turn but three sectors
+    mt_assert(near(hdd_access(0, 5, 2), 4));  // sector 3 is under the head now
+    long nreq, nsect;
+    double seek, rot, xfer;
+    hdd_stats(&nreq, &nsect, &seek, &rot, &xfer);
+    mt_assert(nreq == 4 && nsect == 5);
+    mt_assert(near(seek, 0) && near(rot, 12) && near(xfer, 5));
+    mt_assert(near(hdd_now(), 17));
+    return 0;
+}
+
+mt_test(test_hdd_virtual_clock) {
+    // 100 full strokes of 9.9 s each would take minutes with a real clock
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    hdd_init(TIMING_LINEAR, 100, 10, 100, 7200, 0, 1);
+    for (int i = 0; i < 100; ++i) hdd_access(i % 2 ? 0 : 99, 0, 1);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    mt_assert(near(hdd_now(), 100 * 99 * 100.0));
+    mt_assert(t1.tv_sec - t0.tv_sec < 2);
+    return 0;
+}
+
+void hdd_tests() {
+    mt_run_test(test_hdd_parse);
+    mt_run_test(test_hdd_linear);
+    mt_run_test(test_hdd_seek_curve);
+    mt_run_test(test_hdd_rotation);
+    mt_run_test(test_hdd_virtual_clock);
+}
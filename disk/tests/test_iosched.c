@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mintest.h"
+#include "iosched.h"
+
+// service a whole queue with a policy, return the total seek distance
+static int service(int policy, int head, int *cyls, int n, int *order) {
+    int dir = 1, seek = 0;
+    int q[16];
+    for (int i = 0; i < n; ++i) q[i] = cyls[i];
+    for (int k = 0; n > 0; ++k) {
+        int i = sched_pick(policy, head, &dir, q, n);
+        seek += abs(q[i] - head);
+        head = order[k] = q[i];
+        memmove(&q[i], &q[i + 1], (--n - i) * sizeof(int));  // keep arrival order
+    }
+    return seek;
+}
+
+mt_test(test_sched_parse) {
+    mt_assert(sched_parse("fcfs") == SCHED_FCFS);
+    mt_assert(sched_parse("sstf") == SCHED_SSTF);
+    mt_assert(sched_parse("scan") == SCHED_SCAN);
+    mt_assert(sched_parse("clook") == SCHED_CLOOK);
+    mt_assert(sched_parse("elevator") == -1);
+    return 0;
+}
+
+mt_test(test_sched_fcfs) {
+    int cyls[] = {98, 183, 37, 122, 14, 124, 65, 67}, order[8];
+    mt_assert(service(SCHED_FCFS, 53, cyls, 8, order) == 640);
+    for (int i = 0; i < 8; ++i) mt_assert(order[i] == cyls[i]);
+    return 0;
+}
+
+mt_test(test_sched_sstf) {
+    int cyls[] = {98, 183, 37, 122, 14, 124, 65, 67}, order[8];
+    int expect[] = {65, 67, 37, 14, 98, 122, 124, 183};
+    mt_assert(service(SCHED_SSTF, 53, cyls, 8, order) == 236);
+    for (int i = 0; i < 8; ++i) mt_assert(order[i] == expect[i]);
+    return 0;
+}
+
+mt_test(test_sched_scan) {
+    int cyls[] = {98, 183, 37, 122, 14, 124, 65, 67}, order[8];
+    int expect[] = {65, 67, 98, 122, 124, 183, 37, 14};
+    mt_assert(service(SCHED_SCAN, 53, cyls, 8, order) == 299);
+    for (int i = 0; i < 8; ++i) mt_assert(order[i] == expect[i]);
+    return 0;
+}
+
+mt_test(test_sched_clook) {
+    int cyls[] = {98, 183, 37, 122, 14, 124, 65, 67}, order[8];
+    int expect[] = {65, 67, 98, 122, 124, 183, 14, 37};
+    mt_assert(service(SCHED_CLOOK, 53, cyls, 8, order) == 322);
+    for (int i = 0; i < 8; ++i) mt_assert(order[i] == expect[i]);
+    return 0;
+}
+
+mt_test(test_sched_stats) {
+    sched_init(SCHED_SSTF);
+    int cyls[] = {5, 1, 9};
+    for (int i = 0; i < 3; ++i) {
+        sched_enter(cyls[i]);
+        sched_leave();
+    }
+    long nreq, seek, fcfs_seek;
+    sched_stats(&nreq, &seek, &fcfs_seek);
+    mt_assert(nreq == 3);
+    mt_assert(seek == 5 + 4 + 8);  // one at a time, nothing to reorder
+    mt_assert(fcfs_seek == seek);
+    return 0;
+}
+
+void sched_tests() {
+    mt_run_test(test_sched_parse);
+    mt_run_test(test_sched_fcfs);
+    mt_run_test(test_sched_sstf);
+    mt_run_test(test_sched_scan);
+    mt_run_test(test_sched_clook);
+    mt_run_test(test_sched_stats);
+}
@@ -0,0 +1,48 @@
+#ifndef __BCACHE_H__
+#define __BCACHE_H__
+
+#include "block.h"
+#include "common.h"
+
+// write-back cache of single blocks in front of the disk servers, used by
+// read_block() and write_block(), dirty blocks reach the disk on
+// bcache_sync() or when they are evicted
+
+enum {
+    BC_LRU = 0,    // evict the least recently used block
+    BC_FIFO = 1,   // evict the block cached longest ago
+    BC_CLOCK = 2,  // second chance, a hit sets a reference bit the hand clears
+};
+
+// blocks cached when bcache_init() is never called
+#define BCACHE_SIZE 1024
+
+typedef struct {
+    long hits, misses;
+    long evictions;   // blocks dropped to make room
+    long writebacks;  // dirty blocks written to the disk
+} bcache_counters;
+
+// parse "lru", "fifo" or "clock", with ":blocks" for the size, or "off",
+// return -1 if invalid
+int bcache_parse(const char *spec, int *policy, int *nblocks);
+// drop everything, dirty blocks included, and start over with nblocks
+// (0 turns the cache off), writeback writes dirty blocks, disk_batch if NULL
+void bcache_init(int policy, int nblocks, void (*writeback)(block_req *reqs, int n));
+
+// copy block bno into buf, 0 on a hit, -1 on a miss
+int bcache_get(uint bno, uchar *buf);
+// the same, but neither counted nor a use of the block
+int bcache_peek(uint bno, uchar *buf);
+// cache block bno, dirty if the disk does not have it yet
+void bcache_put(uint bno, const uchar *buf, int dirty);
+// forget blocks [bno, bno + n), dirty ones are not written
+void bcache_invalidate(uint bno, uint n);
+// write every dirty block back, adjacent ones in one request
+void bcache_sync();
+
+void bcache_stats(bcache_counters *c);
+// log the counters
+void bcache_report();
+
+#endif
@@ -1,12 +1,17 @@
 #ifndef __BLOCK_H__
 #define __BLOCK_H__
 
+#include "bds_proto.h"
 #include "common.h"
 
 #define MAGIC 0xFACE2025
 
 #define NBBLOCK(size) (size / BPB + 1)
 
+// block checksums per block, and checksum blocks for size blocks
+#define CPB (BSIZE / sizeof(uint))
+#define NCBLOCK(size) ((size + CPB - 1) / CPB)
+
 #define MAXUSER 12
 
 typedef struct {
@@ -24,23 +29,133 @@ typedef struct {
     uint datastart;
     uint lastmodify;
     _user users[MAXUSER]; 
+    uint freezero;   // FREEZERO when free data blocks read as zeros
+    uint cgsize;     // blocks per cylinder group, 0 for a single group
+    uint ipg;        // inodes per cylinder group
+    uint csumstart;  // first checksum block of a group, 0 for no checksums
     // Other fields can be added as needed
 } superblock;
 
-// Disk layout:
-// superblock | bitmap | inode | data
+// free data blocks were discarded, so allocating one needs no zeroing, a
+// magic rather than a flag as older images may hold anything there
+#define FREEZERO 0xD15CA2D0
+
+// Disk layout, a run of cylinder groups each laid out as:
+// superblock | bitmap | checksums | inode | data
+// with bmapstart, csumstart, inodestart and datastart relative to the
+// group, the superblock of group 0 is the one in use, the others are copies
 
 // sb is defined in block.c
 extern superblock sb;
 
 void zero_block(uint bno);
+// number of cylinder groups, and free blocks in group g
+uint cg_count();
+uint cg_free(uint g);
+// a block in group g, or the nearest group after it with one free
+uint allocate_block_in(uint g);
+// a block in the group allocated from last
 uint allocate_block();
+// up to n free blocks in a row, without zeroing them as the caller writes
+// every one, from group g on like allocate_block_in(), returns the first
+// and sets *len, which is 0 when the disk is full
+uint allocate_run(uint g, uint n, uint *len);
+// the block is discarded in the background, see flush_discards()
 void free_block(uint bno);
 
 void diskseverinit(int port);
+// connect to the disk servers in spec, "<port>" or "<level>[:unit]:<port>,..."
+// with level raid0, raid1 or raid10 (see raid.h), -1 on failure, other
+// threads get connections of their own when they first need them.
+// "file:<image>[:<ncyl>:<nsec>]" (1024 by 63 by default) instead opens the
+// image in this process, with the disk server's code and no network between
+int diskarrayinit(const char *spec);
+// stop the scrubber, then write back and close an image attached by diskarrayinit()
+void diskarrayclose();
+
+// one request of a batch
+typedef struct {
+    int op;        // BDS_OP_READ, BDS_OP_WRITE, BDS_OP_DISCARD, BDS_OP_FLUSH or BDS_OP_INFO
+    uint blockno;  // INFO: set to the number of cylinders
+    uint n;        // blocks, INFO: set to sectors per cylinder
+    uchar *buf;
+    int status;    // BDS_OK or the error, set by disk_batch
+} block_req;
+
+// an asynchronous request, from bio_submit() until bio_wait() frees it
+typedef struct bio bio;
+struct bio {
+    block_req req;                    // req.status is final once complete
+    void (*done)(bio *b, void *arg);  // runs on completion, may be NULL
+    void *arg;
+    int pending;                      // pieces not complete, 0 once complete
+    int raw;                          // past the buffer cache and free map
+    unsigned long seq;                // writes completed before it went out
+    int cls;                          // iotrace.h class, unless raw
+    long start;                       // ns, when it was submitted
+    struct channel *chan;             // the connections it went out on
+};
+
+// start reading or writing n consecutive blocks and return at once, each disk
+// server keeps up to BDS_QDEPTH pieces in flight and may complete them in any
+// order. done runs from the bio_poll() or bio_wait() that reaps the last one.
+// A write goes straight to the disk servers like write_blocks(), buf must stay
+// untouched until it completes, a read sees what the buffer cache has.
+// Each thread checks its own connections to the disk servers out of a pool,
+// a bio goes out on those of the thread submitting it, waiting for it from
+// another thread is only safe while that one is idle, as under the FS lock.
+bio *bio_submit(int op, uint blockno, uint n, uchar *buf, void (*done)(bio *b, void *arg), void *arg);
+// take in whatever completions arrived, without waiting, 1 if b is complete
+int bio_poll(bio *b);
+// wait until b completes, free it and return its status
+int bio_wait(bio *b);
+// bio_wait() each of them, the first error or BDS_OK
+int bio_wait_all(bio **bios, int n);
+
+// read n blocks into the buffer cache in the background, none of them is
+// cached if a write or discard of any is sent before they arrive
+void read_ahead(uint blockno, uint n);
+// wait for every read_ahead() in flight
+void read_ahead_wait();
+
+// submit every request raw, past the caches, and wait for all of them
+void disk_batch(block_req *reqs, int n);
+
+// Each block of a file system with csumstart has a CRC32C in its group's
+// checksum blocks, kept in memory and written back on flush_disk(). Every
+// read is checked against it when its bio completes, raw ones included, and
+// a mismatch is logged as an error. A block with a write in flight, or
+// written since the read went out, is not checked.
+
+// start an empty table for the file system format() is laying out in sb,
+// rather than loading the one on disk
+void csum_format();
+// read [from, from + n) past the caches and check it, returns the blocks that
+// did not match
+int scrub(uint from, uint n);
+// check the whole disk in the background, a batch of blocks every interval_ms
+void scrub_start(int interval_ms);
+void scrub_stop();
+// log the blocks checked and the mismatches found
+void csum_report();
 
 void get_disk_info(int *ncyl, int *nsec);
+// through the buffer cache (bcache.h), a write reaches the disk servers on
+// flush_disk() at the latest, a read that misses waits on a bio
 void read_block(int blockno, uchar *buf);
 void write_block(int blockno, uchar *buf);
+// n consecutive blocks, one bio waited for, writes go straight to the disk servers
+void read_blocks(int blockno, int n, uchar *buf);
+void write_blocks(int blockno, int n, uchar *buf);
+// discard n consecutive blocks so they read as zeros, -1 if the disk
+// servers refused any of them
+int discard_blocks(int blockno, int n);
+// send the discards of blocks freed so far, in as few ranges as possible
+void flush_discards();
+// hook runs first in every flush_disk(), for writes held back above the block layer
+void set_flush_hook(void (*hook)());
+// barrier, writes back the buffer cache and returns once every earlier write
+// and discard is durable on the disk server
+void flush_disk();
 
 #endif
\ No newline at end of file
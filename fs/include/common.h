@@ -15,10 +15,18 @@ typedef unsigned int uint;
 // addresses per block
 #define APB (BSIZE / sizeof(uint))
 
-// block of free map containing bit for block b
-#define BBLOCK(b) ((b) / BPB + sb.bmapstart)
+// blocks and inodes per cylinder group, a file system formatted without
+// groups is one group spanning the whole disk
+#define CGSIZE (sb.cgsize ? sb.cgsize : sb.size)
+#define IPG (sb.ipg ? sb.ipg : sb.ninodes)
+// cylinder group of block b, of inode i
+#define BGROUP(b) ((b) / CGSIZE)
+#define IGROUP(i) ((i) / IPG)
+
+// block of free map containing bit for block b, each group maps its own blocks
+#define BBLOCK(b) (BGROUP(b) * CGSIZE + sb.bmapstart + (b) % CGSIZE / BPB)
 // containg block for inode i
-#define IBLOCK(i) ((i) / IPB + sb.inodestart)
+#define IBLOCK(i) (IGROUP(i) * CGSIZE + sb.inodestart + (i) % IPG / IPB)
 
 #define max(a, b) ((a) > (b) ? (a) : (b))
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -0,0 +1,14 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stddef.h>
+
+#include "common.h"
+
+// CRC32C (Castagnoli) of n bytes continuing from crc, 0 to start, with the
+// SSE4.2 crc32 instruction where the CPU has it, slicing-by-8 otherwise
+uint crc32c(uint crc, const void *buf, size_t n);
+// always slicing-by-8
+uint crc32c_sw(uint crc, const void *buf, size_t n);
+
+#endif
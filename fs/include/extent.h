@@ -0,0 +1,33 @@
+#ifndef __EXTENT_H__
+#define __EXTENT_H__
+
+#include "inode.h"
+
+// block mapping of an inode with M_EXTENT set: each run of blocks of the file
+// that is also a run on disk is one extent, so a file written in one piece
+// maps in the inode itself whatever its length. addrs holds the root of a
+// B-tree of extents sorted by block of the file, NIEXTENT of them; past that
+// the root moves down into a block of its own and holds the index of its
+// children. Every function here is called with the inode locked.
+
+typedef struct {  // 12 bytes
+    uint lstart;  // first block of the file
+    uint start;   // its disk block, in an index the child's block
+    uint len;     // blocks, 0 in an index
+} extent;
+
+// entries in the inode, and in a block of the tree
+#define NIEXTENT ((sizeof(((inode *)0)->addrs) - 2 * sizeof(uint)) / sizeof(extent))
+#define NEXTENT ((BSIZE - 3 * sizeof(uint)) / sizeof(extent))
+
+// disk block of block bno of the file, 0 if it has none, else *len blocks
+// from there on are in the same extent
+uint extent_map(inode *ip, uint bno, uint *len);
+// map the n blocks of the file from bno on, none of which is mapped, to the
+// disk blocks from addr on, allocating blocks of the tree on the way
+void extent_set(inode *ip, uint bno, uint addr, uint n);
+// free the disk blocks of the file from block from on, and the blocks of the
+// tree no longer needed
+void extent_trunc(inode *ip, uint from);
+
+#endif
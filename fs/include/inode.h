@@ -1,15 +1,16 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+#include <pthread.h>
+
 #include "common.h"
 
 #define NDIRECT 9  // Direct blocks, you can change this value
 
+// blocks of a file mapped through indirect blocks, one mapped by extents
+// only has its size to go by
 #define MAXFILEB (NDIRECT + APB + APB * APB)
 
-#define NINODE(size) (size / 2)
-#define NIBLOCK(size) (size / 2 / IPB + 1)
-
 enum {
     T_DIR = 1,   // Directory
     T_FILE = 2,  // File
@@ -21,6 +22,11 @@ enum {
     W = 0b01,
 };
 
+// mode bits past the permissions
+enum {
+    M_EXTENT = 1 << 15,  // blocks mapped by extents, see extent.h
+};
+
 // You should add more fields
 // the size of a dinode must divide BSIZE
 typedef struct {  // 64 bytes
@@ -31,12 +37,23 @@ typedef struct {  // 64 bytes
     uint mtime;               // Last modified time
     uint size;                // Size in bytes
     uint blocks;              // Number of blocks, may be larger than size
-    uint addrs[NDIRECT + 2];  // Data block addresses, the last two are indirect blocks
+    uint addrs[NDIRECT + 2];  // Data block addresses, the last two are indirect blocks,
+                              // with M_EXTENT the root of the extent tree
 } dinode;
 
-// inode in memory
-// more useful fields can be added, e.g. reference count
+// a run of blocks of the file that is a run on disk too, as last mapped
 typedef struct {
+    uint bno, addr;
+    uint len;  // 0 if unused
+} l2p;
+
+// runs an inode in memory keeps, a directory of this many blocks allocated
+// one at a time still maps without reading an indirect or extent block
+#define NL2P 16
+
+// inode in memory, one per inum shared by every iget() of it
+typedef struct inode inode;
+struct inode {
     uint inum;
     ushort type;
     ushort mode;
@@ -45,8 +62,22 @@ typedef struct {
     uint mtime;
     uint size;
     uint blocks;
-    uint addrs[NDIRECT + 2]; // the last two are indirect blocks
-} inode;
+    uint addrs[NDIRECT + 2]; // as in dinode
+    l2p map[NL2P];            // forgotten when blocks are mapped or freed
+    int nextmap;              // the one to replace next
+    int ref;                  // iget()s not put yet, under the cache's lock
+    int dirty;                // changed since iflush(), which holds a reference until then
+    pthread_mutex_t lock;     // held while an inode.c function uses the fields, recursive
+    inode *hnext;             // hash chain
+    inode *prev, *next;       // unused inodes, the least recently put last
+};
+
+// unused inodes kept in memory, the least recently put ones go first
+#define NICACHE 256
+
+// blocks writei() holds back without a disk block, past this many it gives
+// them all one
+#define NDELAYED 1024
 
 // You can change the size of MAXNAME
 #define MAXNAME 12
@@ -58,24 +89,40 @@ typedef struct {  // 16 bytes
 
 // Get an inode by number (returns allocated inode or NULL)
 // Don't forget to use iput()
+// the inode in memory if it is there, without reading its block
 inode *iget(uint inum);
 
 // Free an inode (or decrement reference count)
+// an unused one stays in memory until NICACHE others were put after it
 void iput(inode *ip);
+// forget every inode in memory, changes not flushed included, the file
+// system is being formatted
+void idrop_cache();
 
 // Allocate a new inode of specified type (returns allocated inode or NULL)
 // Don't forget to use iput()
 inode *ialloc(short type);
+// the same, the first free inode of cylinder group g or of a group after it
+inode *ialloc_group(short type, uint g);
 
 // Update disk inode with memory inode contents
+// on the next iflush(), which writes each inode block once whatever number
+// of its inodes changed
 void iupdate(inode *ip);
 
 // Read from an inode (returns bytes read or -1 on error)
 int readi(inode *ip, uchar *dst, uint off, uint n);
 
 // Write to an inode (returns bytes written or -1 on error)
+// blocks the file has no disk block for yet get one on the next flush_disk()
 int writei(inode *ip, uchar *src, uint off, uint n);
 
+// allocate and write every block writei() held back, then every inode
+// changed since the last time, runs on flush_disk()
+void iflush();
+// forget them, the file system is being formatted
+void idrop_delayed();
+
 // check inode pointer, return TRUE when ip != NULL
 int checkIp(inode *ip);
 
@@ -83,6 +130,8 @@ int checkIp(inode *ip);
 int itest(inode *ip);
 
 // Create an inode, return 0 when success
+// a file's blocks are mapped by extents, a directory's by direct and indirect
+// blocks, ialloc() leaves M_EXTENT to the caller
 int icreate(short type, char *name, uint pinum, ushort uid, ushort perm);
 
 // free all data blocks of an inode, but not the inode itself
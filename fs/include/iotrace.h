@@ -0,0 +1,56 @@
+#ifndef __IOTRACE_H__
+#define __IOTRACE_H__
+
+#include "common.h"
+
+// block I/O of the file system by the caller class it was for, counted by
+// read_block(), write_block() and every bio_submit() that is not raw, with a
+// histogram of how long each took from the caller's side. The counters are
+// updated without a lock, a report may be a request or two behind.
+
+enum {
+    IO_SUPER = 0,     // superblock and its copies
+    IO_BITMAP = 1,    // free map
+    IO_INODE = 2,     // inode table
+    IO_INDIRECT = 3,  // indirect and extent tree blocks of files
+    IO_DIR = 4,       // blocks of directories
+    IO_DATA = 5,      // blocks of files, and anything else
+    IO_NCLASS = 6,
+};
+
+enum {
+    IO_READ = 0,
+    IO_WRITE = 1,
+};
+
+// latency buckets, 4 per power of two nanoseconds, up to about 40 minutes
+#define IO_BUCKETS 160
+
+typedef struct {
+    long calls, blocks;
+    long ns;  // total
+    long hist[IO_BUCKETS];
+} iotrace_counters;
+
+// set the class the calling thread's requests to blocks past the metadata
+// are for, returns the previous one so a caller can put it back, IO_DATA at
+// first. Requests to the superblock, free map and inode table are classed by
+// where the block lies, whatever the thread's class.
+int io_class(int cls);
+// the class of a request of this thread starting at blockno
+int iotrace_class(uint blockno);
+
+// one request of n blocks of class cls that took ns
+void iotrace_record(int cls, int op, int n, long ns);
+void iotrace_reset();
+void iotrace_stats(int cls, int op, iotrace_counters *c);
+// time in ns below which the fraction q (0..1) of the requests in c finished
+long iotrace_percentile(const iotrace_counters *c, double q);
+
+// human readable table, at most size bytes including the terminating 0,
+// returns its length
+int iotrace_format(char *buf, int size);
+// log the table
+void iotrace_report();
+
+#endif
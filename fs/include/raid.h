@@ -0,0 +1,38 @@
+#ifndef __RAID_H__
+#define __RAID_H__
+
+#include "common.h"
+
+// how file system blocks are spread over several disk servers
+enum {
+    RAID_SINGLE = 0,  // one disk server
+    RAID_0 = 1,       // striped, no redundancy
+    RAID_1 = 2,       // every disk holds every block
+    RAID_10 = 3,      // striped over mirrored pairs
+};
+
+#define RAID_MAXDISK 8
+// stripe unit in blocks when the spec does not give one
+#define RAID_UNIT 16
+
+typedef struct {
+    int level;
+    int unit;   // blocks per stripe unit, RAID_0 and RAID_10
+    int ndisk;
+} raid_layout;
+
+// parse "<port>" or "<level>[:unit]:<port>,<port>,..." where level is
+// raid0, raid1 or raid10, fills ports, returns -1 if invalid
+int raid_parse(const char *spec, raid_layout *l, int *ports);
+
+// blocks the array holds when every disk holds disk_blocks
+uint raid_capacity(const raid_layout *l, uint disk_blocks);
+
+// copies of every block, and the disk and block number of copy c of block b
+int raid_ncopies(const raid_layout *l);
+int raid_map(const raid_layout *l, uint b, int c, uint *pblock);
+
+// consecutive blocks from b that stay consecutive on one disk
+uint raid_extent(const raid_layout *l, uint b);
+
+#endif
@@ -0,0 +1,296 @@
+#include "bcache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bds_proto.h"
+#include "log.h"
+
+static const char *names[] = {"lru", "fifo", "clock"};
+
+typedef struct {
+    uint bno;
+    int valid, dirty;
+    int ref;         // CLOCK reference bit
+    int prev, next;  // LRU: most recently used first, FIFO: newest first
+    int hnext;       // hash chain
+    uchar data[BSIZE];
+} centry;
+
+static struct {
+    int ready;
+    int policy, n;
+    centry *e;
+    int *bucket, nbucket;
+    int head, tail;  // -1 when empty
+    int hand;
+    int *free, nfree;
+    void (*writeback)(block_req *reqs, int n);
+    bcache_counters c;
+} cache;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+int bcache_parse(const char *spec, int *policy, int *nblocks) {
+    if (strcmp(spec, "off") == 0) {
+        *nblocks = 0;
+        return 0;
+    }
+    int len = strcspn(spec, ":");
+    for (*policy = BC_CLOCK; *policy >= BC_LRU; --*policy)
+        if (strlen(names[*policy]) == len && strncmp(spec, names[*policy], len) == 0) break;
+    if (*policy < BC_LRU) return -1;
+    if (spec[len] == ':') {
+        char *end;
+        long n = strtol(spec + len + 1, &end, 10);
+        if (*end || n <= 0 || n > 1 << 20) return -1;
+        *nblocks = n;
+    }
+    return 0;
+}
+
+static void init_locked(int policy, int nblocks, void (*writeback)(block_req *, int)) {
+    free(cache.e);
+    free(cache.bucket);
+    free(cache.free);
+    memset(&cache, 0, sizeof(cache));
+    cache.ready = 1;
+    cache.policy = policy;
+    cache.n = nblocks;
+    cache.writeback = writeback ? writeback : disk_batch;
+    cache.head = cache.tail = -1;
+    if (nblocks == 0) return;
+    cache.e = calloc(nblocks, sizeof(centry));
+    for (cache.nbucket = 1; cache.nbucket < 2 * nblocks; cache.nbucket <<= 1);
+    cache.bucket = malloc(cache.nbucket * sizeof(int));
+    for (int i = 0; i < cache.nbucket; ++i) cache.bucket[i] = -1;
+    cache.free = malloc(nblocks * sizeof(int));
+    for (int i = nblocks - 1; i >= 0; --i) cache.free[cache.nfree++] = i;
+}
+
+void bcache_init(int policy, int nblocks, void (*writeback)(block_req *reqs, int n)) {
+    pthread_mutex_lock(&lock);
+    init_locked(policy, nblocks, writeback);
+    pthread_mutex_unlock(&lock);
+}
+
+static void ensure() {
+    if (!cache.ready) init_locked(BC_LRU, BCACHE_SIZE, NULL);
+}
+
+static int *chain(uint bno) {
+    return &cache.bucket[(bno * 2654435761u) & (cache.nbucket - 1)];
+}
+
+static int lookup(uint bno) {
+    for (int i = *chain(bno); i >= 0; i = cache.e[i].hnext)
+        if (cache.e[i].bno == bno) return i;
+    return -1;
+}
+
+static void list_remove(int i) {
+    centry *x = &cache.e[i];
+    if (x->prev >= 0) cache.e[x->prev].next = x->next; else cache.head = x->next;
+    if (x->next >= 0) cache.e[x->next].prev = x->prev; else cache.tail = x->prev;
+}
+
+static void list_push(int i) {
+    centry *x = &cache.e[i];
+    x->prev = -1;
+    x->next = cache.head;
+    if (cache.head >= 0) cache.e[cache.head].prev = i; else cache.tail = i;
+    cache.head = i;
+}
+
+// a hit on entry i
+static void touch(int i) {
+    if (cache.policy == BC_LRU) {
+        list_remove(i);
+        list_push(i);
+    }
+    cache.e[i].ref = 1;
+}
+
+// write a copy of entry i back through the writeback function, without the
+// lock: waiting for the write completes reads ahead, which fill the cache
+static void write_one(int i) {
+    uchar data[BSIZE];
+    block_req r = {BDS_OP_WRITE, cache.e[i].bno, 1, data};
+    memcpy(data, cache.e[i].data, BSIZE);
+    cache.e[i].dirty = 0;
+    pthread_mutex_unlock(&lock);
+    cache.writeback(&r, 1);
+    pthread_mutex_lock(&lock);
+    if (r.status != BDS_OK) Error("bcache: error writing back block %u", r.blockno);
+    cache.c.writebacks++;
+}
+
+// take entry i out of the cache, without writing it
+static void release(int i) {
+    centry *x = &cache.e[i];
+    int *p = chain(x->bno);
+    while (*p != i) p = &cache.e[*p].hnext;
+    *p = x->hnext;
+    list_remove(i);
+    x->valid = 0;
+    cache.free[cache.nfree++] = i;
+}
+
+// an entry to reuse, a victim of the policy once none is free, -1 if the
+// victim had to be written back and was used meanwhile, anything looked up
+// before must then be looked up again
+static int take() {
+    if (cache.nfree == 0) {
+        int victim = cache.tail;
+        if (cache.policy == BC_CLOCK) {
+            // every entry is valid here, clear reference bits until one is unset
+            for (;; cache.hand = (cache.hand + 1) % cache.n)
+                if (cache.e[cache.hand].ref) {
+                    cache.e[cache.hand].ref = 0;
+                } else {
+                    victim = cache.hand;
+                    cache.hand = (cache.hand + 1) % cache.n;
+                    break;
+                }
+        }
+        uint bno = cache.e[victim].bno;
+        if (cache.e[victim].dirty) {
+            write_one(victim);
+            centry *x = &cache.e[victim];
+            if (!x->valid || x->bno != bno || x->dirty) return -1;
+        }
+        release(victim);
+        cache.c.evictions++;
+    }
+    return cache.free[--cache.nfree];
+}
+
+int bcache_get(uint bno, uchar *buf) {
+    pthread_mutex_lock(&lock);
+    ensure();
+    int i = cache.n ? lookup(bno) : -1;
+    if (i >= 0) {
+        memcpy(buf, cache.e[i].data, BSIZE);
+        touch(i);
+        cache.c.hits++;
+    } else {
+        cache.c.misses++;
+    }
+    pthread_mutex_unlock(&lock);
+    return i >= 0 ? 0 : -1;
+}
+
+int bcache_peek(uint bno, uchar *buf) {
+    pthread_mutex_lock(&lock);
+    ensure();
+    int i = cache.n ? lookup(bno) : -1;
+    if (i >= 0) memcpy(buf, cache.e[i].data, BSIZE);
+    pthread_mutex_unlock(&lock);
+    return i >= 0 ? 0 : -1;
+}
+
+void bcache_put(uint bno, const uchar *buf, int dirty) {
+    pthread_mutex_lock(&lock);
+    ensure();
+    if (cache.n == 0) {
+        // no cache, a write goes straight through
+        pthread_mutex_unlock(&lock);
+        if (dirty) {
+            block_req r = {BDS_OP_WRITE, bno, 1, (uchar *)buf};
+            cache.writeback(&r, 1);
+            if (r.status != BDS_OK) Error("bcache: error writing block %u", bno);
+        }
+        return;
+    }
+    int i;
+    while ((i = lookup(bno)) < 0 && (i = take()) < 0);
+    if (cache.e[i].valid && cache.e[i].bno == bno) {
+        touch(i);
+    } else {
+        centry *x = &cache.e[i];
+        x->bno = bno;
+        x->valid = 1;
+        x->dirty = 0;
+        x->ref = 0;
+        x->hnext = *chain(bno);
+        *chain(bno) = i;
+        list_push(i);
+    }
+    memcpy(cache.e[i].data, buf, BSIZE);
+    cache.e[i].dirty |= dirty;
+    pthread_mutex_unlock(&lock);
+}
+
+void bcache_invalidate(uint bno, uint n) {
+    pthread_mutex_lock(&lock);
+    ensure();
+    if (n < cache.n) {
+        for (uint b = bno; b < bno + n; ++b) {
+            int i = lookup(b);
+            if (i >= 0) release(i);
+        }
+    } else {
+        for (int i = 0; i < cache.n; ++i)
+            if (cache.e[i].valid && cache.e[i].bno >= bno && cache.e[i].bno - bno < n) release(i);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static int by_block(const void *a, const void *b) {
+    uint x = cache.e[*(const int *)a].bno, y = cache.e[*(const int *)b].bno;
+    return x < y ? -1 : x > y;
+}
+
+// the dirty blocks are copied and marked clean, then written without the lock
+// as in write_one()
+void bcache_sync() {
+    pthread_mutex_lock(&lock);
+    ensure();
+    int *dirty = malloc((cache.n + 1) * sizeof(int)), ndirty = 0;
+    for (int i = 0; i < cache.n; ++i)
+        if (cache.e[i].valid && cache.e[i].dirty) dirty[ndirty++] = i;
+    if (ndirty > 0) {
+        // copy runs of adjacent blocks together, each run is one ranged write
+        qsort(dirty, ndirty, sizeof(int), by_block);
+        uchar *buf = malloc(ndirty * BSIZE);
+        block_req *reqs = malloc(ndirty * sizeof(block_req));
+        int nreq = 0;
+        for (int k = 0; k < ndirty; ++k) {
+            centry *x = &cache.e[dirty[k]];
+            block_req *prev = nreq ? &reqs[nreq - 1] : NULL;
+            memcpy(buf + k * BSIZE, x->data, BSIZE);
+            if (prev && prev->blockno + prev->n == x->bno && prev->n < BDS_MAXSEC)
+                prev->n++;
+            else
+                reqs[nreq++] = (block_req){BDS_OP_WRITE, x->bno, 1, buf + k * BSIZE};
+            x->dirty = 0;
+        }
+        cache.c.writebacks += ndirty;
+        pthread_mutex_unlock(&lock);
+        cache.writeback(reqs, nreq);
+        for (int k = 0; k < nreq; ++k)
+            if (reqs[k].status != BDS_OK)
+                Error("bcache: error writing back blocks %u-%u", reqs[k].blockno, reqs[k].blockno + reqs[k].n - 1);
+        free(reqs);
+        free(buf);
+    } else {
+        pthread_mutex_unlock(&lock);
+    }
+    free(dirty);
+}
+
+void bcache_stats(bcache_counters *c) {
+    pthread_mutex_lock(&lock);
+    *c = cache.c;
+    pthread_mutex_unlock(&lock);
+}
+
+void bcache_report() {
+    bcache_counters c;
+    bcache_stats(&c);
+    long total = c.hits + c.misses;
+    Log("Buffer cache: %s, %d blocks, %ld hits, %ld misses (%.1f%% hit rate), %ld evictions, %ld writebacks",
+        cache.n ? names[cache.policy] : "off", cache.n, c.hits, c.misses, total ? 100.0 * c.hits / total : 0.0,
+        c.evictions, c.writebacks);
+}
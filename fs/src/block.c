@@ -1,50 +1,479 @@
 #include "block.h"
 
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "bcache.h"
+#include "bds_proto.h"
 #include "common.h"
+#include "crc32c.h"
+#include "disk.h"
+#include "iotrace.h"
 #include "log.h"
+#include "raid.h"
 #include "tcp_utils.h"
 
 superblock sb;
-tcp_client diskfd;
 
 static int _ncyl, _nsec;
 
+static void (*flush_hook)();
+
+// freed blocks not discarded yet, they go out together as ranges
+#define NDISCARD 256
+static uint pending_discard[NDISCARD];
+static int npending;
+static int no_discard;  // the disk servers refused a discard, stop asking
+
+static long now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
 void zero_block(uint bno) {
     uchar buf[BSIZE];
     memset(buf, 0, BSIZE);
     write_block(bno, buf);
 }
 
-uint allocate_block() {
-    uchar bitmap[BSIZE];
-    for(int i = 0; i < sb.size; i += BPB){
-        read_block(BBLOCK(i), bitmap);
-        for (int j = 0; j < BPB; ++j){
-            if(j == sb.size) break;
-            int m = 1 << (j % 8);
-            if ((bitmap[j / 8] & m) == 0) {
-                bitmap[j / 8] |= m;
-                write_block(BBLOCK(i), bitmap);
-                zero_block(i + j);
-                return i + j;
-            }
+// take bno off the pending discards, 1 if it was there
+static int undo_discard(uint bno) {
+    for (int i = 0; i < npending; ++i)
+        if (pending_discard[i] == bno) {
+            pending_discard[i] = pending_discard[--npending];
+            return 1;
         }
-    }
-    Warn("alloc_block: Out of blocks");
     return 0;
 }
 
+// the free map, kept in memory once loaded and written back lazily, each
+// cylinder group's map blocks in a row, the bit for block b of group g is bit
+// g * bpg * BPB + b % CGSIZE, which is bit n % 64 of little endian word n / 64
+static uchar *bmap;
+static uint bmap_size, bmap_start, bmap_cgsize;  // the file system it was loaded for
+static uint bpg;                                 // map blocks per group
+static uchar *bmap_dirty;                        // per map block
+static uint *cursor;                             // per group, next-fit, where its next search starts
+static uint last_group;                          // where allocate_block() allocated last
+
+static int bmap_stale() {
+    return bmap_size != sb.size || bmap_start != sb.bmapstart || bmap_cgsize != sb.cgsize;
+}
+
+uint cg_count() {
+    return sb.size ? (sb.size + CGSIZE - 1) / CGSIZE : 0;
+}
+
+// blocks in group g, the last one may be short
+static uint group_len(uint g) {
+    return min(CGSIZE, sb.size - g * CGSIZE);
+}
+
+// load the map for the current superblock, -1 if there is none
+static int bmap_load() {
+    if (bmap && !bmap_stale()) return 0;
+    if (sb.size == 0) return -1;
+    free(bmap);
+    free(bmap_dirty);
+    free(cursor);
+    // NULL while reading, so read_blocks() does not consult it
+    bmap = NULL;
+    uint ncg = cg_count();
+    bpg = NBBLOCK(CGSIZE);
+    uchar *map = malloc(ncg * bpg * BSIZE);
+    for (uint g = 0; g < ncg; ++g) read_blocks(g * CGSIZE + sb.bmapstart, bpg, map + g * bpg * BSIZE);
+    bmap = map;
+    bmap_dirty = calloc(ncg * bpg, 1);
+    cursor = calloc(ncg, sizeof(uint));
+    last_group = 0;
+    bmap_size = sb.size;
+    bmap_start = sb.bmapstart;
+    bmap_cgsize = sb.cgsize;
+    return 0;
+}
+
+// map blocks of group g among [blockno, blockno + n), returns the first, count in *nmap
+static int bmap_overlap(uint g, int blockno, int n, int *nmap) {
+    int start = g * bmap_cgsize + bmap_start;
+    int first = max(blockno, start), last = min(blockno + n, (int)(start + bpg));
+    *nmap = last - first;
+    return first < last ? first : -1;
+}
+
+// groups whose map blocks may lie in [blockno, blockno + n)
+static void bmap_groups(int blockno, int n, uint *from, uint *to) {
+    uint cgsize = bmap_cgsize ? bmap_cgsize : bmap_size;
+    *from = blockno / cgsize;
+    *to = min((uint)(blockno + n - 1) / cgsize + 1, (bmap_size + cgsize - 1) / cgsize);
+}
+
+static int is_map_block(int blockno) {
+    if (!bmap) return 0;
+    uint from, to;
+    int nmap;
+    bmap_groups(blockno, 1, &from, &to);
+    return from < to && bmap_overlap(from, blockno, 1, &nmap) >= 0;
+}
+
+// blocks [blockno, blockno + n) were written from buf, take in map blocks among them
+static void bmap_written(int blockno, int n, const uchar *buf) {
+    if (bmap && bmap_stale()) {
+        // a new file system, load its map when it is next needed
+        free(bmap);
+        bmap = NULL;
+        return;
+    }
+    if (!bmap || n <= 0) return;
+    uint from, to;
+    bmap_groups(blockno, n, &from, &to);
+    for (uint g = from; g < to; ++g) {
+        int nmap, first = bmap_overlap(g, blockno, n, &nmap);
+        if (first < 0) continue;
+        uint k = first - (g * bmap_cgsize + bmap_start);  // within the group
+        memcpy(bmap + (g * bpg + k) * BSIZE, buf + (first - blockno) * BSIZE, nmap * BSIZE);
+        memset(bmap_dirty + g * bpg + k, 0, nmap);
+        // the write may have freed anything those map blocks cover
+        cursor[g] = min(cursor[g], k * BPB);
+    }
+}
+
+// the in memory map is newer than any copy of map blocks among [blockno, blockno + n)
+static void bmap_read(int blockno, int n, uchar *buf) {
+    if (!bmap || n <= 0) return;
+    uint from, to;
+    bmap_groups(blockno, n, &from, &to);
+    for (uint g = from; g < to; ++g) {
+        int nmap, first = bmap_overlap(g, blockno, n, &nmap);
+        if (first < 0) continue;
+        uint k = first - (g * bmap_cgsize + bmap_start);
+        memcpy(buf + (first - blockno) * BSIZE, bmap + (g * bpg + k) * BSIZE, nmap * BSIZE);
+    }
+}
+
+// hand dirty map blocks to the buffer cache
+static void bmap_flush() {
+    if (!bmap) return;
+    uint cgsize = bmap_cgsize ? bmap_cgsize : bmap_size;
+    for (uint i = 0; i < (bmap_size + cgsize - 1) / cgsize * bpg; ++i)
+        if (bmap_dirty[i]) {
+            uint bno = i / bpg * cgsize + bmap_start + i % bpg;
+            long start = now_ns();
+            bcache_put(bno, bmap + i * BSIZE, 1);
+            iotrace_record(iotrace_class(bno), IO_WRITE, 1, now_ns() - start);
+            bmap_dirty[i] = 0;
+        }
+}
+
+// bit of block b in the map
+static uint map_bit(uint b) {
+    return b / CGSIZE * bpg * BPB + b % CGSIZE;
+}
+
+static void bmap_set(uint b, int used) {
+    uint n = map_bit(b);
+    if (used)
+        bmap[n / 8] |= 1 << (n % 8);
+    else
+        bmap[n / 8] &= ~(1 << (n % 8));
+    bmap_dirty[n / BPB] = 1;
+}
+
+static int is_free(uint b) {
+    uint n = map_bit(b);
+    return (bmap[n / 8] & (1 << (n % 8))) == 0;
+}
+
+// first clear bit of the map in [from, to), to if none, a whole word at a time
+static uint scan_bits(uint from, uint to) {
+    for (uint i = from; i < to; i = i / 64 * 64 + 64) {
+        uint64_t word;
+        memcpy(&word, bmap + i / 64 * 8, 8);
+        word |= (1ull << (i % 64)) - 1;  // bits before from
+        if (~word == 0) continue;
+        return min(i / 64 * 64 + __builtin_ctzll(~word), to);
+    }
+    return to;
+}
+
+// first free block of group g from its cursor on, wrapping around within the
+// group, then of the groups after it, sb.size if none
+static uint find_free(uint g) {
+    uint ncg = cg_count();
+    for (uint k = 0; k < ncg; ++k) {
+        uint h = (g + k) % ncg, base = h * bpg * BPB, len = group_len(h);
+        uint r = scan_bits(base + cursor[h], base + len) - base;
+        if (r < len) return h * CGSIZE + r;
+        r = scan_bits(base, base + cursor[h]) - base;
+        if (r < cursor[h]) return h * CGSIZE + r;
+    }
+    return sb.size;
+}
+
+uint cg_free(uint g) {
+    if (bmap_load() < 0 || g >= cg_count()) return 0;
+    uint base = g * bpg * BPB, len = group_len(g), used = 0;
+    for (uint i = 0; i < len; i += 64) {
+        uint64_t word;
+        memcpy(&word, bmap + (base + i) / 8, 8);
+        if (len - i < 64) word &= (1ull << (len - i)) - 1;
+        used += __builtin_popcountll(word);
+    }
+    return len - used;
+}
+
+// the group's next search starts after block b
+static void advance(uint b) {
+    last_group = b / CGSIZE;
+    cursor[last_group] = (b % CGSIZE + 1) % group_len(last_group);
+}
+
+uint allocate_block() {
+    return allocate_block_in(last_group);
+}
+
+uint allocate_block_in(uint g) {
+    if (bmap_load() < 0) {
+        Warn("alloc_block: Not formatted");
+        return 0;
+    }
+    uint b = find_free(g < cg_count() ? g : 0);
+    if (b == sb.size) {
+        Warn("alloc_block: Out of blocks");
+        return 0;
+    }
+    bmap_set(b, 1);
+    advance(b);
+    // a discarded block already reads as zeros, one still
+    // waiting for its discard holds what was freed
+    if (undo_discard(b) || no_discard || sb.freezero != FREEZERO) zero_block(b);
+    return b;
+}
+
+uint allocate_run(uint g, uint n, uint *len) {
+    *len = 0;
+    if (bmap_load() < 0) {
+        Warn("allocate_run: Not formatted");
+        return 0;
+    }
+    uint b = find_free(g < cg_count() ? g : 0);
+    if (b == sb.size) {
+        Warn("allocate_run: Out of blocks");
+        return 0;
+    }
+    // a run stays within its group
+    uint end = b / CGSIZE * CGSIZE + group_len(b / CGSIZE);
+    while (*len < n && b + *len < end && is_free(b + *len)) {
+        bmap_set(b + *len, 1);
+        undo_discard(b + *len);  // it is about to be written, a late discard would wipe it
+        ++*len;
+    }
+    advance(b + *len - 1);
+    return b;
+}
+
 void free_block(uint bno) {
-    uchar bitmap[BSIZE];
-    read_block(BBLOCK(bno), bitmap);
-    int i = bno % BPB;
-    int m = 1 << (i % 8);
-    if ((bitmap[i / 8] & m) == 0) Warn("free_block: Freeing free block");
-    bitmap[i / 8] &= ~m;
-    write_block(BBLOCK(bno), bitmap);
+    if (bmap_load() < 0 || bno >= sb.size) {
+        Warn("free_block: Invalid block %u", bno);
+        return;
+    }
+    if (is_free(bno)) {
+        Warn("free_block: Freeing free block");
+        return;  // already queued, or allocated before it was discarded
+    }
+    bmap_set(bno, 0);
+    bcache_invalidate(bno, 1);  // its contents are dead, never write them back
+    if (no_discard) return;
+    if (npending == NDISCARD) flush_discards();
+    pending_discard[npending++] = bno;
+}
+
+// the checksum table, laid out in memory as on disk: each group's checksum
+// blocks in a row, the checksum of block b of group g is entry
+// g * cpg * CPB + b % group size. 0 means not known, a block whose CRC is 0 is
+// stored as 1. The scrubber thread reads it too, so csum_lock guards it and
+// the geometry it was loaded for is used rather than sb.
+static pthread_mutex_t csum_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint *csum;
+static uint csum_size, csum_cgsize, csum_start;  // the file system it was loaded for
+static uint cpg;                                 // checksum blocks per group
+static uchar *csum_dirty;                        // per checksum block
+static int *csum_busy;                           // per checksum block, writes in flight
+static unsigned long *csum_wseq;                 // per checksum block, wseq when last written
+static unsigned long wseq;                       // writes and discards completed
+static long nverified, nmismatch;
+static __thread int in_scrubber;
+
+static bio *submit(block_req *r, int raw, void (*done)(bio *b, void *arg), void *arg);
+
+static uint block_csum(const uchar *buf) {
+    uint c = crc32c(0, buf, BSIZE);
+    return c ? c : 1;
+}
+
+static uint csum_group_size() {
+    return csum_cgsize ? csum_cgsize : csum_size;
+}
+
+static uint csum_entry(uint b) {
+    return b / csum_group_size() * cpg * CPB + b % csum_group_size();
+}
+
+// checksum block covering block b, consecutive blocks have consecutive ones
+static uint csum_block(uint b) {
+    return csum_entry(b) / CPB;
+}
+
+static int is_csum_block(uint b) {
+    uint k = b % csum_group_size();
+    return k >= csum_start && k < csum_start + cpg;
+}
+
+// take the table out, csum_lock held
+static void csum_drop() {
+    free(csum);
+    free(csum_dirty);
+    free(csum_busy);
+    free(csum_wseq);
+    csum = NULL;
+    csum_dirty = NULL;
+    csum_busy = NULL;
+    csum_wseq = NULL;
+}
+
+// put table in for the current superblock, csum_lock held
+static void csum_install(uint *table) {
+    csum_drop();
+    uint nblock = cg_count() * NCBLOCK(CGSIZE);
+    csum = table;
+    csum_dirty = calloc(nblock, 1);
+    csum_busy = calloc(nblock, sizeof(int));
+    csum_wseq = calloc(nblock, sizeof(unsigned long));
+    csum_size = sb.size;
+    csum_cgsize = sb.cgsize;
+    csum_start = sb.csumstart;
+    cpg = NCBLOCK(CGSIZE);
+}
+
+static int csum_stale() {
+    if (sb.magic != MAGIC || !sb.csumstart) return csum != NULL;
+    return !csum || csum_size != sb.size || csum_cgsize != sb.cgsize || csum_start != sb.csumstart;
+}
+
+void csum_format() {
+    pthread_mutex_lock(&csum_lock);
+    csum_install(calloc(cg_count() * NCBLOCK(CGSIZE), BSIZE));
+    pthread_mutex_unlock(&csum_lock);
+}
+
+// load the table of the current superblock, or drop it if there is none
+static void csum_load() {
+    static int loading;
+    if (loading || !csum_stale()) return;
+    pthread_mutex_lock(&csum_lock);
+    csum_drop();  // no checking against the old one meanwhile
+    pthread_mutex_unlock(&csum_lock);
+    if (sb.magic != MAGIC || !sb.csumstart) return;
+    loading = 1;
+    uint ncg = cg_count(), per = NCBLOCK(CGSIZE);
+    uint *table = malloc(ncg * per * BSIZE);
+    bio **bios = malloc(ncg * sizeof(bio *));
+    for (uint g = 0; g < ncg; ++g) {
+        block_req r = {BDS_OP_READ, g * CGSIZE + sb.csumstart, per, (uchar *)(table + g * per * CPB)};
+        bios[g] = submit(&r, 1, NULL, NULL);
+    }
+    if (bio_wait_all(bios, ncg) != BDS_OK) {
+        Error("checksums: error reading the checksum blocks, not checking");
+        memset(table, 0, ncg * per * BSIZE);
+    }
+    free(bios);
+    pthread_mutex_lock(&csum_lock);
+    csum_install(table);
+    pthread_mutex_unlock(&csum_lock);
+    loading = 0;
+}
+
+// a write or discard of [blockno, blockno + n) goes out
+static void csum_begin(uint blockno, uint n) {
+    pthread_mutex_lock(&csum_lock);
+    if (csum && blockno < csum_size)
+        for (uint k = csum_block(blockno); k <= csum_block(min(blockno + n, csum_size) - 1); ++k) csum_busy[k]++;
+    pthread_mutex_unlock(&csum_lock);
+}
+
+// a write or discard completed, take in the checksums of what the disk holds now
+static void csum_end(bio *b) {
+    block_req *r = &b->req;
+    pthread_mutex_lock(&csum_lock);
+    if (csum && r->blockno < csum_size) {
+        uint last = min(r->blockno + r->n, csum_size) - 1;
+        static const uchar zero[BSIZE];
+        uint zero_csum = block_csum(zero);
+        for (uint blk = r->blockno; blk <= last; ++blk) {
+            if (is_csum_block(blk)) continue;
+            uint c = 0;  // unknown after a failure
+            if (r->status == BDS_OK) c = r->op == BDS_OP_DISCARD ? zero_csum : block_csum(r->buf + (blk - r->blockno) * BSIZE);
+            csum[csum_entry(blk)] = c;
+            csum_dirty[csum_block(blk)] = 1;
+        }
+        ++wseq;
+        for (uint k = csum_block(r->blockno); k <= csum_block(last); ++k) {
+            if (csum_busy[k] > 0) csum_busy[k]--;  // the table may be newer than the write
+            csum_wseq[k] = wseq;
+        }
+    }
+    pthread_mutex_unlock(&csum_lock);
+}
+
+// a read completed, check what it brought against the table
+static void csum_check(bio *b) {
+    block_req *r = &b->req;
+    pthread_mutex_lock(&csum_lock);
+    for (uint i = 0; csum && i < r->n && r->blockno + i < csum_size; ++i) {
+        uint blk = r->blockno + i, want = csum[csum_entry(blk)], k = csum_block(blk);
+        // the disk may hold something other than what the table says
+        if (!want || is_csum_block(blk) || csum_busy[k] || csum_wseq[k] > b->seq) continue;
+        nverified++;
+        if (block_csum(r->buf + i * BSIZE) != want) {
+            nmismatch++;
+            Error("checksums: block %u does not match its checksum, corrupted on disk", blk);
+        }
+    }
+    pthread_mutex_unlock(&csum_lock);
+}
+
+// write dirty checksum blocks back, past the buffer cache
+static void csum_flush() {
+    pthread_mutex_lock(&csum_lock);
+    uint nblock = csum ? (csum_size + csum_group_size() - 1) / csum_group_size() * cpg : 0, nreq = 0;
+    block_req *reqs = malloc((nblock + 1) * sizeof(block_req));
+    for (uint k = 0; k < nblock; ++k) {
+        if (!csum_dirty[k]) continue;
+        csum_dirty[k] = 0;
+        uint bno = k / cpg * csum_group_size() + csum_start + k % cpg;
+        block_req *prev = nreq ? &reqs[nreq - 1] : NULL;
+        if (prev && prev->blockno + prev->n == bno && prev->n < BDS_MAXSEC)
+            prev->n++;
+        else
+            reqs[nreq++] = (block_req){BDS_OP_WRITE, bno, 1, (uchar *)(csum + k * CPB)};
+    }
+    pthread_mutex_unlock(&csum_lock);
+    // only this thread changes the table, so it may be written unlocked
+    disk_batch(reqs, nreq);
+    for (uint i = 0; i < nreq; ++i)
+        if (reqs[i].status != BDS_OK) Error("checksums: error writing checksum block %u", reqs[i].blockno);
+    free(reqs);
+}
+
+void csum_report() {
+    pthread_mutex_lock(&csum_lock);
+    Log("Checksums: %ld blocks checked, %ld mismatches", nverified, nmismatch);
+    pthread_mutex_unlock(&csum_lock);
 }
 
 // #define NCYL 1024
@@ -52,73 +481,758 @@ void free_block(uint bno) {
 
 // static uchar diskfile[NCYL * NSEC][BSIZE];
 
+// a disk server of the array, shared by every thread, and by the scrubber,
+// which does not hold the FS command lock, so disks_lock guards these
+typedef struct {
+    int port;
+    int nsec;   // sectors per cylinder, to place the head
+    int head;   // cylinder of the last request sent
+    long load;  // sectors queued or in flight
+} disk_member;
+
+static disk_member disks[RAID_MAXDISK];
+static pthread_mutex_t disks_lock = PTHREAD_MUTEX_INITIALIZER;
+static raid_layout layout;
+static int connected;
+
+// the disk is an image attached in this process rather than disk servers,
+// disk.c serves each piece as it is sent, one at a time
+static int direct;
+static int direct_ncyl, direct_nsec;
+static pthread_mutex_t direct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// a connection to every disk server of the array, each thread checks one out
+// of the pool on its first request and it goes back when the thread exits
+typedef struct channel {
+    tcp_client fd[RAID_MAXDISK];
+    struct sub_req *queue[RAID_MAXDISK], *tail[RAID_MAXDISK];  // not sent yet
+    struct sub_req *slot[RAID_MAXDISK][BDS_QDEPTH];            // in flight, by tag
+    int inflight[RAID_MAXDISK];
+    char *msg;             // one frame
+    struct channel *next;  // in the pool
+} channel;
+
+static channel *pool;
+static int nchannel;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t chan_key;
+static __thread channel *mine;
+
+static tcp_client connect_disk(int port){
+    tcp_client fd = client_init("localhost", port);
+    if(!fd) return NULL;
+    // every request after this is a binary bds_hdr frame
+    char msg[16];
+    client_send(fd, "B", 2);
+    int ret = client_recv(fd, msg, sizeof(msg) - 1);
+    if(ret < 4 || strncmp(msg, "Yes ", 4) != 0){
+        Error("Disk sever on port %d does not speak binary framing", port);
+        client_destroy(fd);
+        return NULL;
+    }
+    return fd;
+}
+
+static void close_channel(channel *ch){
+    for (int d = 0; d < layout.ndisk; ++d)
+        if(ch->fd[d]) client_destroy(ch->fd[d]);
+    free(ch->msg);
+    free(ch);
+}
+
+static channel *open_channel(){
+    channel *ch = calloc(1, sizeof(channel));
+    ch->msg = malloc(sizeof(bds_hdr) + BDS_MAXSEC * BSIZE);
+    for (int d = 0; d < layout.ndisk && !direct; ++d)
+        if(!(ch->fd[d] = connect_disk(disks[d].port))){
+            close_channel(ch);
+            return NULL;
+        }
+    return ch;
+}
+
+static void kick(channel *ch);
+static int reap(channel *ch, int timeout_ms);
+
+// the thread is exiting, finish what it has in flight and pool its channel
+static void release_channel(void *p){
+    channel *ch = p;
+    for (int d = 0; d < layout.ndisk; ++d)
+        while(ch->queue[d] || ch->inflight[d]){
+            kick(ch);
+            reap(ch, -1);
+        }
+    pthread_mutex_lock(&pool_lock);
+    ch->next = pool;
+    pool = ch;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// the calling thread's channel, NULL if the disk servers cannot be reached
+static channel *my_channel(){
+    if(mine || !connected) return mine;
+    pthread_mutex_lock(&pool_lock);
+    if(pool){
+        mine = pool;
+        pool = pool->next;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if(!mine){
+        if(!(mine = open_channel())) return NULL;
+        pthread_mutex_lock(&pool_lock);
+        int n = ++nchannel;
+        pthread_mutex_unlock(&pool_lock);
+        if(n > 1) Log("Disk connections: %d sets open", n);
+    }
+    pthread_setspecific(chan_key, mine);
+    return mine;
+}
+
+// "<image>[:<ncyl>:<nsec>]", opened like BDS does, durable on BDS_OP_FLUSH
+static int attach_image(const char *arg){
+    char path[256];
+    int len = strcspn(arg, ":"), end = 0;
+    direct_ncyl = 1024;
+    direct_nsec = 63;
+    if(len == 0 || len >= sizeof(path)) return -1;
+    if(arg[len] && (sscanf(arg + len, ":%d:%d%n", &direct_ncyl, &direct_nsec, &end) != 2 || arg[len + end]))
+        return -1;
+    if(direct_ncyl <= 0 || direct_nsec <= 0) return -1;
+    memcpy(path, arg, len);
+    path[len] = 0;
+    set_durability(DUR_WRITEBACK, 0, 0);
+    if(init_disk(path, direct_ncyl, direct_nsec, 0) < 0) return -1;
+    Log("Disk image %s attached directly, %d cylinders, %d sectors per cylinder", path, direct_ncyl, direct_nsec);
+    return 0;
+}
+
+int diskarrayinit(const char *spec){
+    int ports[RAID_MAXDISK];
+    if(strncmp(spec, "file:", 5) == 0){
+        if(attach_image(spec + 5) < 0){
+            Error("Cannot attach disk image '%s'", spec + 5);
+            return -1;
+        }
+        layout = (raid_layout){RAID_SINGLE, RAID_UNIT, 1};
+        disks[0] = (disk_member){0, direct_nsec};
+        pthread_key_create(&chan_key, release_channel);
+        direct = connected = 1;
+        return 0;
+    }
+    if(raid_parse(spec, &layout, ports) < 0){
+        Error("Invalid disk server list '%s'", spec);
+        return -1;
+    }
+    for (int i = 0; i < layout.ndisk; ++i) disks[i] = (disk_member){ports[i], 1};
+    pthread_key_create(&chan_key, release_channel);
+    // the first channel is the caller's, opening it checks every server is up
+    connected = 1;
+    if(!my_channel()){
+        connected = 0;
+        return -1;
+    }
+    if(layout.level != RAID_SINGLE)
+        Log("Disk array: %s over %d disk servers, stripe unit %d blocks", spec, layout.ndisk, layout.unit);
+    return 0;
+}
+
+void diskarrayclose(){
+    scrub_stop();
+    if(!direct) return;
+    close_disk();
+    direct = connected = 0;
+}
+
 void diskseverinit(int port){
-    diskfd = client_init("localhost", port);
+    char spec[16];
+    sprintf(spec, "%d", port);
+    diskarrayinit(spec);
+}
+
+// a piece of a bio for one disk server
+typedef struct sub_req {
+    bio *parent;
+    int disk;
+    int op;
+    uint lba, n;  // INFO: set to cylinders and sectors per cylinder
+    uchar *buf;
+    struct sub_req *next;  // in its disk's queue
+} sub_req;
+
+static void add_sub(bio *b, int disk, int op, uint lba, uint n, uchar *buf){
+    sub_req *s = malloc(sizeof(sub_req));
+    *s = (sub_req){b, disk, op, lba, n, buf, NULL};
+    channel *ch = b->chan;
+    if(ch->tail[disk]) ch->tail[disk]->next = s; else ch->queue[disk] = s;
+    ch->tail[disk] = s;
+    b->pending++;
+    disk_member *d = &disks[disk];
+    if(op == BDS_OP_READ || op == BDS_OP_WRITE){
+        pthread_mutex_lock(&disks_lock);
+        d->load += n;
+        d->head = (lba + n - 1) / d->nsec;
+        pthread_mutex_unlock(&disks_lock);
+    }
+}
+
+// copy of block b a read goes to: the least loaded disk, then the nearest head
+static int pick_copy(uint b){
+    int best = -1;
+    long best_load = 0, best_dist = 0;
+    pthread_mutex_lock(&disks_lock);
+    for (int c = 0; c < raid_ncopies(&layout); ++c) {
+        uint pb;
+        disk_member *d = &disks[raid_map(&layout, b, c, &pb)];
+        long dist = labs((long)(pb / d->nsec) - d->head);
+        if(best < 0 || d->load < best_load || (d->load == best_load && dist < best_dist)){
+            best = c;
+            best_load = d->load;
+            best_dist = dist;
+        }
+    }
+    pthread_mutex_unlock(&disks_lock);
+    return best;
+}
+
+// split a request into the pieces each disk server gets
+static void split(bio *b){
+    block_req *r = &b->req;
+    if(r->op == BDS_OP_INFO || r->op == BDS_OP_FLUSH){
+        for (int d = 0; d < layout.ndisk; ++d) add_sub(b, d, r->op, 0, 0, NULL);
+        return;
+    }
+    uint most = r->op == BDS_OP_DISCARD ? BDS_MAXDISCARD : BDS_MAXSEC;
+    for (uint blk = r->blockno, left = r->n; left > 0;) {
+        uint cnt = min(min(left, raid_extent(&layout, blk)), most);
+        uchar *buf = r->buf ? r->buf + (blk - r->blockno) * BSIZE : NULL;
+        uint pb;
+        if(r->op == BDS_OP_READ){
+            int disk = raid_map(&layout, blk, pick_copy(blk), &pb);
+            add_sub(b, disk, r->op, pb, cnt, buf);
+        } else {
+            // writes and discards reach every copy
+            for (int c = 0; c < raid_ncopies(&layout); ++c) {
+                int disk = raid_map(&layout, blk, c, &pb);
+                add_sub(b, disk, r->op, pb, cnt, buf);
+            }
+        }
+        blk += cnt;
+        left -= cnt;
+    }
+}
+
+static void send_sub(channel *ch, sub_req *s, uint tag){
+    char *msg = ch->msg;
+    bds_hdr *hdr = (bds_hdr *)msg;
+    hdr->magic = BDS_MAGIC;
+    hdr->opcode = s->op;
+    hdr->status = 0;
+    hdr->tag = htonl(tag);
+    hdr->lba = htonl(s->lba);
+    hdr->count = htonl(s->n);
+    int len = sizeof(bds_hdr);
+    if(s->op == BDS_OP_WRITE){
+        memcpy(msg + len, s->buf, s->n * BSIZE);
+        len += s->n * BSIZE;
+    }
+    client_send(ch->fd[s->disk], msg, len);
+}
+
+static void complete_sub(sub_req *s, int status);
+
+// serve a piece from the attached image, as a disk server would
+static int serve_direct(sub_req *s){
+    int cyl = s->lba / direct_nsec, sec = s->lba % direct_nsec, status = BDS_OK;
+    if((s->op == BDS_OP_READ || s->op == BDS_OP_WRITE || s->op == BDS_OP_DISCARD) &&
+       (long)s->lba + s->n > (long)direct_ncyl * direct_nsec)
+        return BDS_EINVAL;
+    // the range is on the disk, what fails now is the image
+    pthread_mutex_lock(&direct_lock);
+    switch(s->op){
+    case BDS_OP_INFO:
+        s->lba = direct_ncyl;
+        s->n = direct_nsec;
+        break;
+    case BDS_OP_READ:
+        if(disk_cmd_rv(cyl, sec, s->n, (char *)s->buf) != 0) status = BDS_EIO;
+        break;
+    case BDS_OP_WRITE:
+        if(disk_cmd_wv(cyl, sec, s->n, (char *)s->buf) != 0) status = BDS_EIO;
+        break;
+    case BDS_OP_FLUSH:
+        if(disk_cmd_f() != 0) status = BDS_EIO;
+        break;
+    case BDS_OP_DISCARD:
+        if(disk_cmd_d(cyl, sec, s->n) != 0) status = BDS_EIO;
+        break;
+    }
+    pthread_mutex_unlock(&direct_lock);
+    return status;
+}
+
+// send what the disk servers have room for, each keeps up to BDS_QDEPTH
+// in flight, tagged with their slot, and may finish them in any order
+static void kick(channel *ch){
+    if(direct){
+        // nothing to wait for, each piece completes as it is taken
+        while(ch->queue[0]){
+            sub_req *s = ch->queue[0];
+            ch->queue[0] = s->next;
+            if(!ch->queue[0]) ch->tail[0] = NULL;
+            complete_sub(s, serve_direct(s));
+        }
+        return;
+    }
+    for (int d = 0; d < layout.ndisk; ++d) {
+        for (int t = 0; ch->queue[d] && ch->inflight[d] < BDS_QDEPTH; ++t) {
+            if(ch->slot[d][t]) continue;
+            sub_req *s = ch->queue[d];
+            ch->queue[d] = s->next;
+            if(!ch->queue[d]) ch->tail[d] = NULL;
+            ch->slot[d][t] = s;
+            ch->inflight[d]++;
+            send_sub(ch, s, t);
+        }
+    }
+}
+
+// every piece is done
+static void finish(bio *b){
+    block_req *r = &b->req;
+    if(r->op == BDS_OP_INFO && r->status == BDS_OK && r->n > 0)
+        r->blockno = raid_capacity(&layout, r->blockno * r->n) / r->n;
+    if(r->op == BDS_OP_WRITE || r->op == BDS_OP_DISCARD) csum_end(b);
+    // what came from the disk, before the caches overlay it
+    if(r->op == BDS_OP_READ && r->status == BDS_OK) csum_check(b);
+    if(!b->raw && r->op == BDS_OP_READ){
+        // cached blocks may be newer than the disk, and the free map than both
+        for (uint i = 0; i < r->n; ++i) bcache_peek(r->blockno + i, r->buf + i * BSIZE);
+        bmap_read(r->blockno, r->n, r->buf);
+    }
+    if(!b->raw && (r->op == BDS_OP_READ || r->op == BDS_OP_WRITE))
+        iotrace_record(b->cls, r->op == BDS_OP_WRITE ? IO_WRITE : IO_READ, r->n, now_ns() - b->start);
+    if(b->done) b->done(b, b->arg);
+}
+
+static void complete_sub(sub_req *s, int status){
+    bio *b = s->parent;
+    block_req *r = &b->req;
+    if(status != BDS_OK) r->status = status;
+    pthread_mutex_lock(&disks_lock);
+    if(s->op == BDS_OP_INFO && status == BDS_OK){
+        // the array's geometry: the smallest disk, times the disks data is spread over
+        disks[s->disk].nsec = s->n > 0 ? s->n : 1;
+        if(r->n == 0 || s->lba * s->n < r->blockno * r->n){
+            r->blockno = s->lba;
+            r->n = s->n;
+        }
+    }
+    if(s->op == BDS_OP_READ || s->op == BDS_OP_WRITE) disks[s->disk].load -= s->n;
+    pthread_mutex_unlock(&disks_lock);
+    free(s);
+    if(--b->pending == 0) finish(b);
+}
+
+// fail everything queued on or sent to disk d, its connection is out of step
+static void fail_disk(channel *ch, int d){
+    for (int t = 0; t < BDS_QDEPTH; ++t)
+        if(ch->slot[d][t]){
+            sub_req *s = ch->slot[d][t];
+            ch->slot[d][t] = NULL;
+            complete_sub(s, BDS_EIO);
+        }
+    ch->inflight[d] = 0;
+    while(ch->queue[d]){
+        sub_req *s = ch->queue[d];
+        ch->queue[d] = s->next;
+        complete_sub(s, BDS_EIO);
+    }
+    ch->tail[d] = NULL;
+}
+
+// take one response from a disk server that has one within timeout_ms
+// (negative: no limit), 0 if none came
+static int reap(channel *ch, int timeout_ms){
+    tcp_client fds[RAID_MAXDISK];
+    int which[RAID_MAXDISK], n = 0;
+    for (int d = 0; d < layout.ndisk; ++d)
+        if(ch->inflight[d]){
+            which[n] = d;
+            fds[n++] = ch->fd[d];
+        }
+    if(n == 0) return 0;
+    int i = client_select(fds, n, timeout_ms);
+    if(i < 0) return 0;
+    int d = which[i];
+    char *msg = ch->msg;
+    bds_hdr *hdr = (bds_hdr *)msg;
+    int ret = client_recv(ch->fd[d], msg, sizeof(bds_hdr) + BDS_MAXSEC * BSIZE);
+    uint t = ntohl(hdr->tag);
+    if(ret < (int)sizeof(bds_hdr) || hdr->magic != BDS_MAGIC || t >= BDS_QDEPTH || !ch->slot[d][t]){
+        Warn("bio: bad response from the disk server on port %d", disks[d].port);
+        fail_disk(ch, d);
+        return 1;
+    }
+    sub_req *s = ch->slot[d][t];
+    ch->slot[d][t] = NULL;
+    ch->inflight[d]--;
+    int status = ntohs(hdr->status);
+    if(status == BDS_OK && s->op == BDS_OP_INFO){
+        s->lba = ntohl(hdr->lba);
+        s->n = ntohl(hdr->count);
+    } else if(status == BDS_OK && s->op == BDS_OP_READ){
+        if(ret < sizeof(bds_hdr) + s->n * BSIZE){
+            Warn("bio: short read response");
+            status = BDS_EIO;
+        } else {
+            memcpy(s->buf, msg + sizeof(bds_hdr), s->n * BSIZE);
+        }
+    }
+    complete_sub(s, status);
+    return 1;
+}
+
+// read ahead in flight, its blocks go to the buffer cache when it completes
+// unless a write or discard of any of them was sent after it
+#define NPREFETCH 16
+typedef struct {
+    bio *b;
+    uint blockno, n;
+    uchar *buf;
+    int stale;
+} prefetch;
+
+static prefetch prefetches[NPREFETCH];
+
+static void cancel_prefetch(uint blockno, uint n){
+    for (int i = 0; i < NPREFETCH; ++i) {
+        prefetch *p = &prefetches[i];
+        if(p->b && p->blockno < blockno + n && blockno < p->blockno + p->n) p->stale = 1;
+    }
+}
+
+static bio *submit(block_req *r, int raw, void (*done)(bio *b, void *arg), void *arg){
+    if(!in_scrubber) csum_load();
+    if(r->op == BDS_OP_WRITE || r->op == BDS_OP_DISCARD){
+        cancel_prefetch(r->blockno, r->n);
+        csum_begin(r->blockno, r->n);
+    }
+    bio *b = calloc(1, sizeof(bio));
+    b->req = *r;
+    b->req.status = BDS_OK;
+    b->done = done;
+    b->arg = arg;
+    b->raw = raw;
+    if(!raw){
+        b->cls = iotrace_class(r->blockno);
+        b->start = now_ns();
+    }
+    if(b->req.op == BDS_OP_INFO) b->req.blockno = b->req.n = 0;
+    if(b->req.op == BDS_OP_READ){
+        pthread_mutex_lock(&csum_lock);
+        b->seq = wseq;
+        pthread_mutex_unlock(&csum_lock);
+    }
+    if(!(b->chan = my_channel())){
+        Error("Disk sever not found");
+        b->req.status = BDS_EIO;
+    } else {
+        // held while splitting, so no piece completes the bio early
+        b->pending = 1;
+        split(b);
+        kick(b->chan);
+        b->pending--;
+    }
+    if(b->pending == 0) finish(b);
+    return b;
+}
+
+bio *bio_submit(int op, uint blockno, uint n, uchar *buf, void (*done)(bio *b, void *arg), void *arg){
+    if(op == BDS_OP_WRITE){
+        // later reads must not find what the cache or the free map held before
+        bcache_invalidate(blockno, n);
+        bmap_written(blockno, n, buf);
+    }
+    block_req r = {op, blockno, n, buf};
+    return submit(&r, 0, done, arg);
+}
+
+int bio_poll(bio *b){
+    if(b->pending == 0) return 1;
+    kick(b->chan);
+    while(reap(b->chan, 0)) kick(b->chan);
+    return b->pending == 0;
+}
+
+int bio_wait(bio *b){
+    while(b->pending){
+        kick(b->chan);
+        reap(b->chan, -1);
+    }
+    int status = b->req.status;
+    free(b);
+    return status;
+}
+
+int bio_wait_all(bio **bios, int n){
+    int status = BDS_OK;
+    for (int i = 0; i < n; ++i) {
+        int s = bio_wait(bios[i]);
+        if(status == BDS_OK) status = s;
+    }
+    return status;
+}
+
+static void prefetched(bio *b, void *arg){
+    prefetch *p = arg;
+    if(p->stale || b->req.status != BDS_OK) return;
+    // a block written to the cache meanwhile is newer
+    uchar tmp[BSIZE];
+    for (uint i = 0; i < p->n; ++i)
+        if(bcache_peek(p->blockno + i, tmp) < 0) bcache_put(p->blockno + i, p->buf + i * BSIZE, 0);
+}
+
+// free slot i once its read has completed, waiting for it if wait
+static void retire_prefetch(int i, int wait){
+    prefetch *p = &prefetches[i];
+    if(!p->b || (!wait && !bio_poll(p->b))) return;
+    bio_wait(p->b);
+    free(p->buf);
+    p->b = NULL;
+}
+
+void read_ahead(uint blockno, uint n){
+    if(!connected || n == 0) return;
+    int slot = -1;
+    for (int i = 0; i < NPREFETCH; ++i) {
+        retire_prefetch(i, 0);
+        if(!prefetches[i].b && slot < 0) slot = i;
+    }
+    if(slot < 0) return;  // enough in flight already
+    prefetch *p = &prefetches[slot];
+    *p = (prefetch){NULL, blockno, n, malloc(n * BSIZE), 0};
+    block_req r = {BDS_OP_READ, blockno, n, p->buf};
+    p->b = submit(&r, 1, prefetched, p);
+}
+
+void read_ahead_wait(){
+    for (int i = 0; i < NPREFETCH; ++i) retire_prefetch(i, 1);
+}
+
+// hand a raw bio's outcome back to the block_req it came from
+static void batch_done(bio *b, void *arg){
+    *(block_req *)arg = b->req;
+}
+
+void disk_batch(block_req *reqs, int n) {
+    bio **bios = malloc((n + 1) * sizeof(bio *));
+    for (int i = 0; i < n; ++i) bios[i] = submit(&reqs[i], 1, batch_done, &reqs[i]);
+    bio_wait_all(bios, n);
+    free(bios);
+}
+
+// straight to the disk servers, for callers that have looked at the caches already
+static int disk_request(int op, uint blockno, uint n, uchar *buf) {
+    block_req r = {op, blockno, n, buf};
+    return bio_wait(submit(&r, 1, NULL, NULL));
+}
+
+// blocks the scrubber reads at a time
+#define SCRUB_BATCH 64
+
+static pthread_t scrubber;
+static int scrubbing, scrub_interval;
+static pthread_mutex_t scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scrub_cond = PTHREAD_COND_INITIALIZER;
+
+int scrub(uint from, uint n) {
+    pthread_mutex_lock(&csum_lock);
+    long before = nmismatch;
+    pthread_mutex_unlock(&csum_lock);
+    uchar *buf = malloc(SCRUB_BATCH * BSIZE);
+    for (uint done = 0; done < n; done += SCRUB_BATCH) {
+        uint cnt = min(n - done, SCRUB_BATCH);
+        // completing the read checks it
+        if (disk_request(BDS_OP_READ, from + done, cnt, buf) != BDS_OK)
+            Warn("scrub: error reading blocks %u-%u", from + done, from + done + cnt - 1);
+    }
+    free(buf);
+    pthread_mutex_lock(&csum_lock);
+    long found = nmismatch - before;
+    pthread_mutex_unlock(&csum_lock);
+    return found;
+}
+
+// a batch at a time from block 0 to the end of the table, then over again
+static void *scrub_main(void *arg) {
+    in_scrubber = 1;  // leaves the table to the threads under the FS lock
+    uint next = 0;
+    pthread_mutex_lock(&scrub_lock);
+    while (scrubbing) {
+        pthread_mutex_unlock(&scrub_lock);
+        pthread_mutex_lock(&csum_lock);
+        uint size = csum ? csum_size : 0;
+        pthread_mutex_unlock(&csum_lock);
+        if (next < size) {
+            uint n = min(size - next, SCRUB_BATCH);
+            scrub(next, n);
+            next += n;
+            if (next == size) Log("Scrubber: checked all %u blocks", size);
+        } else {
+            next = 0;
+        }
+        pthread_mutex_lock(&scrub_lock);
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += scrub_interval / 1000;
+        until.tv_nsec += scrub_interval % 1000 * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        if (scrubbing) pthread_cond_timedwait(&scrub_cond, &scrub_lock, &until);
+    }
+    pthread_mutex_unlock(&scrub_lock);
+    return NULL;
+}
+
+void scrub_start(int interval_ms) {
+    if (scrubbing || interval_ms <= 0) return;
+    scrubbing = 1;
+    scrub_interval = interval_ms;
+    pthread_create(&scrubber, NULL, scrub_main, NULL);
+    Log("Scrubber: %d blocks every %d ms", SCRUB_BATCH, interval_ms);
+}
+
+void scrub_stop() {
+    if (!scrubbing) return;
+    pthread_mutex_lock(&scrub_lock);
+    scrubbing = 0;
+    pthread_cond_signal(&scrub_cond);
+    pthread_mutex_unlock(&scrub_lock);
+    pthread_join(scrubber, NULL);
 }
 
 // get disk info and store in global variables
 void get_disk_info(int *ncyl, int *nsec) {
     // *ncyl = NCYL;
     // *nsec = NSEC;
-    if(!diskfd){
-        Error("Disk sever not found");
-        return;
-    }
-    static char buf[1024];
-    client_send(diskfd, "I", 2);
-    int ret = client_recv(diskfd, buf, sizeof(buf));
-    if(ret < 0){
-        Warn("get_disk_info: recv error");
+    block_req r = {BDS_OP_INFO};
+    disk_batch(&r, 1);
+    if(r.status != BDS_OK){
+        Warn("get_disk_info: request failed");
         return;
     }
-    buf[ret] = 0;
-    sscanf(buf, "%d %d", &_ncyl, &_nsec);
+    _ncyl = r.blockno;
+    _nsec = r.n;
     *ncyl = _ncyl;
     *nsec = _nsec;
 }
 
-void read_block(int blockno, uchar *buf) {
-    // memcpy(buf, diskfile[blockno], BSIZE);
-    if(!diskfd){
-        Error("Disk sever not found");
+static void read_one(int blockno, uchar *buf) {
+    if(is_map_block(blockno)){
+        bmap_read(blockno, 1, buf);
         return;
     }
-    char msg[1024];
-    sprintf(msg, "R %d %d", blockno / _nsec, blockno % _nsec);
-    client_send(diskfd, msg, strlen(msg) + 1);
-    memset(msg, 0, sizeof(msg));
-    int ret = client_recv(diskfd, msg, sizeof(msg));
-    if(ret < 0){
-        Warn("read_block: recv error");
+    if(bcache_get(blockno, buf) == 0) return;
+    if(disk_request(BDS_OP_READ, blockno, 1, buf) != BDS_OK){
+        Error("read_block: error reading block %d", blockno);
         return;
     }
-    msg[ret] = 0;
-    if(strcmp(msg, "No ") == 0){
-        Error("write_block: error writing block");
-    } else {
-        memcpy(buf, msg + 4, BSIZE);  // YES -data-
-    }
+    bcache_put(blockno, buf, 0);
+}
+
+void read_block(int blockno, uchar *buf) {
+    // memcpy(buf, diskfile[blockno], BSIZE);
+    long start = now_ns();
+    read_one(blockno, buf);
+    iotrace_record(iotrace_class(blockno), IO_READ, 1, now_ns() - start);
 }
 
 void write_block(int blockno, uchar *buf) {
     // memcpy(diskfile[blockno], buf, BSIZE);
-    if(!diskfd){
-        Error("Disk sever not found");
-        return;
+    // reaches the disk on flush_disk(), or earlier if the cache evicts it
+    long start = now_ns();
+    bcache_put(blockno, buf, 1);
+    bmap_written(blockno, 1, buf);
+    iotrace_record(iotrace_class(blockno), IO_WRITE, 1, now_ns() - start);
+}
+
+void read_blocks(int blockno, int n, uchar *buf) {
+    if(bio_wait(bio_submit(BDS_OP_READ, blockno, n, buf, NULL, NULL)) != BDS_OK)
+        Error("read_blocks: error reading blocks %d-%d", blockno, blockno + n - 1);
+}
+
+void write_blocks(int blockno, int n, uchar *buf) {
+    if(bio_wait(bio_submit(BDS_OP_WRITE, blockno, n, buf, NULL, NULL)) != BDS_OK)
+        Error("write_blocks: error writing blocks %d-%d", blockno, blockno + n - 1);
+}
+
+static int cmp_uint(const void *a, const void *b) {
+    uint x = *(const uint *)a, y = *(const uint *)b;
+    return x < y ? -1 : x > y;
+}
+
+// discard [blockno, blockno + n) for every range of the list, with fill the
+// ranges the disk servers would not discard are zeroed, returns how many those were
+static int discard_ranges(uint (*ranges)[2], int nrange, int fill) {
+    int nreq = 0;
+    for (int i = 0; i < nrange; ++i) nreq += (ranges[i][1] + BDS_MAXDISCARD - 1) / BDS_MAXDISCARD;
+    block_req *reqs = malloc(nreq * sizeof(block_req));
+    nreq = 0;
+    for (int i = 0; i < nrange; ++i)
+        for (uint done = 0; done < ranges[i][1]; done += BDS_MAXDISCARD)
+            reqs[nreq++] = (block_req){BDS_OP_DISCARD, ranges[i][0] + done,
+                                       min(ranges[i][1] - done, BDS_MAXDISCARD), NULL};
+    for (int i = 0; i < nrange; ++i) bcache_invalidate(ranges[i][0], ranges[i][1]);
+    disk_batch(reqs, nreq);
+    int failed = 0;
+    for (int i = 0; i < nreq; ++i) {
+        if(reqs[i].status == BDS_OK) continue;
+        if(!failed++) Warn("discard: disk servers refused blocks %u-%u", reqs[i].blockno,
+                           reqs[i].blockno + reqs[i].n - 1);
+        if(!fill) continue;
+        uchar *zero = calloc(reqs[i].n, BSIZE);
+        write_blocks(reqs[i].blockno, reqs[i].n, zero);
+        free(zero);
     }
-    char msg[1024];
-    int sptr = sprintf(msg, "W %d %d %d ", 
-        blockno / _nsec, blockno % _nsec, BSIZE);
-    memcpy(msg + sptr, buf, BSIZE);
-    client_send(diskfd, msg, sptr + BSIZE);
-    memset(msg, 0, sizeof(msg));
-    int ret = client_recv(diskfd, msg, sizeof(msg));
-    if(ret < 0){
-        Warn("write_block: recv error");
-        return;
+    free(reqs);
+    return failed;
+}
+
+int discard_blocks(int blockno, int n) {
+    uint range[1][2] = {{blockno, n}};
+    return discard_ranges(range, 1, 0) ? -1 : 0;
+}
+
+void flush_discards() {
+    if(npending == 0) return;
+    // adjacent freed blocks become one range
+    qsort(pending_discard, npending, sizeof(uint), cmp_uint);
+    uint ranges[NDISCARD][2];
+    int nrange = 0;
+    for (int i = 0; i < npending; ++i) {
+        if(nrange > 0 && ranges[nrange - 1][0] + ranges[nrange - 1][1] == pending_discard[i])
+            ranges[nrange - 1][1]++;
+        else
+            ranges[nrange][0] = pending_discard[i], ranges[nrange++][1] = 1;
     }
-    msg[ret] = 0;
-    if(strcmp(msg, "No ") == 0){
-        Error("write_block: error writing block");
+    npending = 0;
+    // allocate_block counts on these reading as zeros, so write them if need be
+    if(discard_ranges(ranges, nrange, sb.freezero == FREEZERO)) no_discard = 1;
+}
+
+void set_flush_hook(void (*hook)()) {
+    flush_hook = hook;
+}
+
+void flush_disk() {
+    if(flush_hook) flush_hook();
+    bmap_flush();
+    bcache_sync();
+    flush_discards();
+    csum_flush();
+    if(disk_request(BDS_OP_FLUSH, 0, 0, NULL) != BDS_OK){
+        Error("flush_disk: error flushing disk");
     }
 }
@@ -0,0 +1,66 @@
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define POLY 0x82F63B78  // reflected
+
+// table[k][b]: the CRC of byte b followed by k zero bytes
+static uint table[8][256];
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static int have_sse42;
+
+static void init() {
+    for (uint b = 0; b < 256; ++b) {
+        uint c = b;
+        for (int i = 0; i < 8; ++i) c = c & 1 ? c >> 1 ^ POLY : c >> 1;
+        table[0][b] = c;
+    }
+    for (uint b = 0; b < 256; ++b)
+        for (int k = 1; k < 8; ++k) table[k][b] = table[k - 1][b] >> 8 ^ table[0][table[k - 1][b] & 0xff];
+#if defined(__x86_64__)
+    have_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+uint crc32c_sw(uint crc, const void *buf, size_t n) {
+    pthread_once(&once, init);
+    const uchar *p = buf;
+    crc = ~crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;  // little endian
+        crc = table[7][lo & 0xff] ^ table[6][lo >> 8 & 0xff] ^ table[5][lo >> 16 & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][hi >> 8 & 0xff] ^ table[1][hi >> 16 & 0xff] ^ table[0][hi >> 24];
+    }
+    while (n--) crc = crc >> 8 ^ table[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint crc32c_hw(uint crc, const uchar *p, size_t n) {
+    uint64_t c = ~crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    while (n--) c = _mm_crc32_u8(c, *p++);
+    return ~(uint)c;
+}
+#endif
+
+uint crc32c(uint crc, const void *buf, size_t n) {
+    pthread_once(&once, init);
+#if defined(__x86_64__)
+    if (have_sse42) return crc32c_hw(crc, buf, n);
+#endif
+    return crc32c_sw(crc, buf, n);
+}
@@ -0,0 +1,167 @@
+#include "extent.h"
+
+#include <string.h>
+
+#include "block.h"
+#include "iotrace.h"
+#include "log.h"
+
+// the root, in ip->addrs, depth 0 when its entries are extents
+typedef struct {
+    uint n, depth;
+    extent e[NIEXTENT];
+} eroot;
+
+// any other node, a block
+#define EXTENT_MAGIC 0x45585431  // "EXT1"
+
+typedef struct {
+    uint magic, n, depth;
+    extent e[NEXTENT];
+    uchar unused[BSIZE - 3 * sizeof(uint) - NEXTENT * sizeof(extent)];
+} enode;
+
+static eroot *root(inode *ip) {
+    return (eroot *)ip->addrs;
+}
+
+// the blocks of the tree are counted as indirect blocks (iotrace.h)
+static void read_node(uint bno, enode *x) {
+    int cls = io_class(IO_INDIRECT);
+    read_block(bno, (uchar *)x);
+    io_class(cls);
+    if (x->magic != EXTENT_MAGIC) {
+        Error("extent: block %u is not a node of an extent tree", bno);
+        x->n = 0;
+    }
+}
+
+static void write_node(uint bno, enode *x) {
+    int cls = io_class(IO_INDIRECT);
+    write_block(bno, (uchar *)x);
+    io_class(cls);
+}
+
+// the last of the n entries starting at or before bno, -1 if none does
+static int find(const extent *e, uint n, uint bno) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (e[mid].lstart <= bno)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+uint extent_map(inode *ip, uint bno, uint *len) {
+    enode x;
+    extent *e = root(ip)->e;
+    uint n = root(ip)->n, depth = root(ip)->depth;
+    for (;;) {
+        int i = find(e, n, bno);
+        if (i < 0) return 0;
+        if (depth == 0) {
+            if (bno - e[i].lstart >= e[i].len) return 0;
+            *len = e[i].len - (bno - e[i].lstart);
+            return e[i].start + (bno - e[i].lstart);
+        }
+        read_node(e[i].start, &x);
+        e = x.e;
+        n = x.n;
+        depth = x.depth;
+    }
+}
+
+// put x after entry i of a node of depth, *n entries with room for cap. A
+// full node keeps its lower part and the rest moves into a new node, then it
+// returns 1 and the entry of the new node for its parent in *up
+static int put(inode *ip, extent *e, uint *n, uint cap, uint depth, int i, extent x, extent *up) {
+    extent all[NEXTENT + 1];
+    memcpy(all, e, (i + 1) * sizeof(extent));
+    all[i + 1] = x;
+    memcpy(all + i + 2, e + i + 1, (*n - i - 1) * sizeof(extent));
+    uint total = *n + 1;
+    if (total <= cap) {
+        memcpy(e, all, total * sizeof(extent));
+        *n = total;
+        return 0;
+    }
+    // a file grows at its end, appending leaves the node full rather than half
+    uint keep = i + 1 == *n ? *n : total / 2;
+    enode y = {.magic = EXTENT_MAGIC, .n = total - keep, .depth = depth};
+    memcpy(y.e, all + keep, y.n * sizeof(extent));
+    memcpy(e, all, keep * sizeof(extent));
+    *n = keep;
+    uint b = allocate_block_in(IGROUP(ip->inum));
+    write_node(b, &y);
+    *up = (extent){y.e[0].lstart, b, 0};
+    return 1;
+}
+
+// insert x into the subtree of a node, merged into the extent it continues
+// if there is one, returns as put()
+static int insert(inode *ip, extent *e, uint *n, uint cap, uint depth, extent x, extent *up) {
+    int i = find(e, *n, x.lstart);
+    if (depth == 0) {
+        if (i >= 0 && e[i].lstart + e[i].len == x.lstart && e[i].start + e[i].len == x.start) {
+            e[i].len += x.len;
+            return 0;
+        }
+        return put(ip, e, n, cap, depth, i, x, up);
+    }
+    if (i < 0) e[i = 0].lstart = x.lstart;  // before every child, the first one takes it
+    enode y;
+    read_node(e[i].start, &y);
+    extent sub;
+    int split = insert(ip, y.e, &y.n, NEXTENT, y.depth, x, &sub);
+    write_node(e[i].start, &y);
+    return split ? put(ip, e, n, cap, depth, i, sub, up) : 0;
+}
+
+void extent_set(inode *ip, uint bno, uint addr, uint n) {
+    eroot *r = root(ip);
+    extent up;
+    if (!insert(ip, r->e, &r->n, NIEXTENT, r->depth, (extent){bno, addr, n}, &up)) return;
+    // the root split: what it kept moves into a node, the root indexes both
+    enode y = {.magic = EXTENT_MAGIC, .n = r->n, .depth = r->depth};
+    memcpy(y.e, r->e, r->n * sizeof(extent));
+    uint b = allocate_block_in(IGROUP(ip->inum));
+    write_node(b, &y);
+    r->e[0] = (extent){y.e[0].lstart, b, 0};
+    r->e[1] = up;
+    r->n = 2;
+    r->depth++;
+}
+
+// free what the subtree of a node maps from block from on, from its last
+// entry back to the first one that keeps something, and the nodes emptied
+static void cut(extent *e, uint *n, uint depth, uint from) {
+    while (*n > 0) {
+        extent *x = &e[*n - 1];
+        if (depth == 0) {
+            if (x->lstart + x->len <= from) return;
+            uint keep = x->lstart < from ? from - x->lstart : 0;
+            for (uint b = keep; b < x->len; ++b) free_block(x->start + b);
+            x->len = keep;
+            if (keep) return;
+        } else {
+            enode y;
+            read_node(x->start, &y);
+            cut(y.e, &y.n, y.depth, from);
+            if (y.n) {
+                write_node(x->start, &y);
+                return;
+            }
+            free_block(x->start);
+        }
+        --*n;
+    }
+}
+
+void extent_trunc(inode *ip, uint from) {
+    eroot *r = root(ip);
+    cut(r->e, &r->n, r->depth, from);
+    if (r->n == 0) r->depth = 0;
+}
@@ -48,6 +48,8 @@ void save_user(id_map *idmap, int id){
             uchar buf[BSIZE];
             memcpy(buf, &sb, sizeof(sb));
             write_block(0, buf);
+            // the command is complete, make it durable before replying
+            flush_disk();
 
             uid = 0;
             cwd = 0;
@@ -61,43 +63,68 @@ void sbinit() {
     uchar buf[BSIZE];
     read_block(0, buf);
     memcpy(&sb, buf, sizeof(sb));
+    // an image from before cylinder groups is one group
+    uint ncg = sb.cgsize ? (sb.size + sb.cgsize - 1) / sb.cgsize : 0;
+    if (!sb.cgsize || sb.cgsize > sb.size || !sb.ipg || sb.ipg % IPB || ncg * sb.ipg != sb.ninodes)
+        sb.cgsize = sb.ipg = 0;
+    // and one from before checksums has none
+    if (!sb.cgsize || sb.csumstart != 1 + NBBLOCK(sb.cgsize) || sb.inodestart != sb.csumstart + NCBLOCK(sb.cgsize))
+        sb.csumstart = 0;
 }
 
 int to_home();
 
 int format(int *ncyl, int *nsec){
-    uchar buf[BSIZE];
+    // writes held back for the old file system must not land in the new one,
+    // nor its inodes in memory be taken for the new ones
+    idrop_delayed();
+    idrop_cache();
 
     sb.magic = MAGIC;
     sb.size = (*ncyl) * (*nsec);
 
-    int ninodes = NINODE(sb.size);
-    int nmeta = 1 + NBBLOCK(sb.size) + NIBLOCK(sb.size);
-
-    sb.ninodes = ninodes;
-    sb.nblocks = sb.size - 1 - NBBLOCK(sb.size) - NIBLOCK(sb.size);
+    // cylinder groups of whole cylinders, as many as one map block covers, so
+    // a file's inode, map bits and data sit a few tracks apart at most
+    sb.cgsize = min(max(1, (BPB - 1) / *nsec) * *nsec, sb.size);
+    sb.ipg = max(IPB, sb.cgsize / 4 / IPB * IPB);  // an inode per 2 KB of data
+    int nmeta = 1 + NBBLOCK(sb.cgsize) + NCBLOCK(sb.cgsize) + sb.ipg / IPB;
+    // a short last group is only kept if it has room for data
+    int ncg = sb.size / sb.cgsize;
+    if (sb.size % sb.cgsize > nmeta) ++ncg;
+    sb.size = min(sb.size, ncg * sb.cgsize);
+    if (ncg == 0 || sb.cgsize <= nmeta) {
+        Warn("format: %u blocks are too few", sb.size);
+        sb.magic = 0;
+        return -1;
+    }
+
+    sb.ninodes = ncg * sb.ipg;
+    sb.nblocks = sb.size - ncg * nmeta;
     sb.bmapstart = 1;
-    sb.inodestart = 1 + NIBLOCK(sb.size);
+    sb.csumstart = 1 + NBBLOCK(sb.cgsize);
+    sb.inodestart = sb.csumstart + NCBLOCK(sb.cgsize);
+    sb.datastart = nmeta;
     sb.users[0].uid = 1;
     sb.users[0].cwd = 0;
-
-    // zero superblock
-    memset(buf, 0, BSIZE);
-    memcpy(buf, &sb, sizeof(sb));
-    write_block(0, buf);
-
-    // bitmap, inode block init
-    memset(buf, 0, BSIZE);
-    for (int i = 0; i < sb.size; i += BPB) write_block(BBLOCK(i), buf);
-    for (int i = 0; i < ninodes; i += IPB) write_block(IBLOCK(i), buf);
-
-    // mark bitmap and inode blocks as in use
-    for (int i = 0; i < nmeta; i += BPB) {
-        memset(buf, 0, BSIZE);
-        for (int j = 0; j < BPB; ++j)
-            if (i + j < nmeta) buf[j / 8] |= 1 << (j % 8);
-        write_block(BBLOCK(i), buf);
-    }
+    csum_format();
+
+    // the data regions read as zeros from here on, if the disk servers discard
+    sb.freezero = FREEZERO;
+    for (int g = 0; g < ncg; ++g) {
+        uint start = g * sb.cgsize + nmeta;
+        if (discard_blocks(start, min(sb.size, start - nmeta + sb.cgsize) - start) < 0) sb.freezero = 0;
+    }
+
+    // each group's metadata in one write: superblock, bitmap with the
+    // metadata marked in use, zeroed checksums and inodes
+    uchar *meta = calloc(nmeta, BSIZE);
+    memcpy(meta, &sb, sizeof(sb));
+    for (int i = 0; i < nmeta; ++i) meta[BSIZE + i / 8] |= 1 << (i % 8);
+    bio **bios = malloc(ncg * sizeof(bio *));
+    for (int g = 0; g < ncg; ++g) bios[g] = bio_submit(BDS_OP_WRITE, g * sb.cgsize, nmeta, meta, NULL, NULL);
+    if (bio_wait_all(bios, ncg) != BDS_OK) Error("format: error writing group metadata");
+    free(bios);
+    free(meta);
 
     cwd = 0;
     // make root dir
@@ -108,6 +135,7 @@ int format(int *ncyl, int *nsec){
     else return -1;
     
     to_home();
+    flush_disk();
     return sb.size;
 }
 
@@ -191,7 +219,7 @@ uint findinum(char *name) {
     readi(ip, buf, 0, ip->size);
     dirent *dir = (dirent *)buf;
 
-    int ninodes = NINODE(sb.size);
+    int ninodes = sb.ninodes;
     int result = ninodes;
     int nfile = ip->size / sizeof(dirent);
     for (int i = 0; i < nfile; ++i) {
@@ -215,7 +243,7 @@ int delinum(uint inum) {
     readi(ip, buf, 0, ip->size);
     dirent *dir = (dirent *)buf;
 
-    int ninodes = NINODE(sb.size);
+    int ninodes = sb.ninodes;
     int nfile = ip->size / sizeof(dirent);
     int deleted = 1;
     for (int i = 0; i < nfile; ++i) {
@@ -272,7 +300,7 @@ int cmd_mk(char *name, short mode) {
         Warn("mk: Invalid name!");
         return E_ERROR;
     }
-    if (findinum(name) != NINODE(sb.size)) {
+    if (findinum(name) != sb.ninodes) {
         Warn("mk: %s already exists!", name);
         return E_ERROR;
     }
@@ -289,7 +317,7 @@ int cmd_mkdir(char *name, short mode) {
         Warn("mkdir: Invalid name!");
         return E_ERROR;
     }
-    if (findinum(name) != NINODE(sb.size)) {
+    if (findinum(name) != sb.ninodes) {
         Warn("mkdir: %s already exists!", name);
         return E_ERROR;
     }
@@ -301,7 +329,7 @@ int cmd_rm(char *name) {
     int ret = checkFmt();
     if(ret) return ret;
     uint inum = findinum(name);
-    if (inum == NINODE(sb.size)) {
+    if (inum == sb.ninodes) {
         Warn("rm: Not found!");
         return E_ERROR;
     }
@@ -330,7 +358,7 @@ int cmd_rm(char *name) {
 }
 
 int cmd_rmdir(char *name) {
-    int ninodes = NINODE(sb.size);
+    int ninodes = sb.ninodes;
     int ret = checkFmt();
     if(ret) return ret;
     uint inum = findinum(name);
@@ -383,7 +411,7 @@ int cmd_rmdir(char *name) {
 
 int _cd(char *name) {
     uint inum = findinum(name);
-    if (inum == NINODE(sb.size)) {
+    if (inum == sb.ninodes) {
         Warn("cd: Not found!");
         return E_ERROR;
     }
@@ -444,7 +472,7 @@ int cmd_ls(entry **entries, int *n) {
     readi(ip, buf, 0, ip->size);
     dirent *dir = (dirent *)buf;
 
-    int nfile = ip->size / sizeof(dirent), ninodes = NINODE(sb.size);
+    int nfile = ip->size / sizeof(dirent), ninodes = sb.ninodes;
     *n = 0;
     if(*entries != NULL){
         Warn("ls: Dirty entry");
@@ -474,11 +502,25 @@ int cmd_ls(entry **entries, int *n) {
     return E_SUCCESS;
 }
 
+// a file is read a chunk at a time, so readi() finds a sequential reader and
+// fetches the next chunks while this one is copied
+#define READ_CHUNK (8 * BSIZE)
+
+static void read_file(inode *ip, uchar *dst, uint off, uint n) {
+    while (n > 0) {
+        uint len = min(n, READ_CHUNK - off % READ_CHUNK);
+        readi(ip, dst, off, len);
+        dst += len;
+        off += len;
+        n -= len;
+    }
+}
+
 int cmd_cat(char *name, uchar **buf, uint *len) {
     int ret = checkFmt();
     if(ret) return ret;
     uint inum = findinum(name);
-    if (inum == NINODE(sb.size)) {
+    if (inum == sb.ninodes) {
         Warn("cat: Not found!");
         return E_ERROR;
     }
@@ -500,7 +542,7 @@ int cmd_cat(char *name, uchar **buf, uint *len) {
         // return E_ERROR;
     } 
     *buf = malloc(ip->size + 2);
-    readi(ip, *buf, 0, ip->size);
+    read_file(ip, *buf, 0, ip->size);
     (*buf)[ip->size] = '\n';
     (*buf)[ip->size + 1] = '\0';
     *len = strlen((const char *)*buf);
@@ -513,7 +555,7 @@ int cmd_w(char *name, uint len, const char *data) {
     int ret = checkFmt();
     if(ret) return ret;
     uint inum = findinum(name);
-    if (inum == NINODE(sb.size)) {
+    if (inum == sb.ninodes) {
         Warn("w: Not found!");
         return E_ERROR;
     }
@@ -549,7 +591,7 @@ int cmd_i(char *name, uint pos, uint len, const char *data) {
     int ret = checkFmt();
     if(ret) return ret;
     uint inum = findinum(name);
-    if (inum == NINODE(sb.size)) {
+    if (inum == sb.ninodes) {
         Warn("i: Not found!");
         return E_ERROR;
     }
@@ -574,7 +616,7 @@ int cmd_i(char *name, uint pos, uint len, const char *data) {
     } else {
         uchar *buf = malloc(ip->size - pos);
         // [pos, size) -> [pos+len, size+len)
-        readi(ip, buf, pos, ip->size - pos);
+        read_file(ip, buf, pos, ip->size - pos);
         writei(ip, (uchar *)data, pos, len);
         writei(ip, buf, pos + len, ip->size - pos);
         free(buf);
@@ -588,7 +630,7 @@ int cmd_d(char *name, uint pos, uint len) {
     int ret = checkFmt();
     if(ret) return ret;
     uint inum = findinum(name);
-    if (inum == NINODE(sb.size)) {
+    if (inum == sb.ninodes) {
         Warn("d: Not found!");
         return E_ERROR;
     }
@@ -609,7 +651,7 @@ int cmd_d(char *name, uint pos, uint len) {
         // [pos + len, size) -> [pos, size - len)
         uint copylen = ip->size - pos - len;
         uchar *buf = malloc(copylen);
-        readi(ip, buf, pos + len, copylen);
+        read_file(ip, buf, pos + len, copylen);
         writei(ip, buf, pos, copylen);
         ip->size -= len;
         iupdate(ip);
@@ -4,23 +4,145 @@
 #include <string.h>
 #include <time.h>
 
+#include "bcache.h"
+#include "bds_proto.h"
 #include "block.h"
+#include "extent.h"
+#include "iotrace.h"
 #include "log.h"
 
-inode *iget(uint inum) {
-    if (inum < 0 || inum >= sb.ninodes) {
-        Warn("iget: Invaild inum %d", inum);
-        return NULL;
+// blocks writei() wrote that have no disk block yet, they get one on the next
+// flush_disk(), each file's in runs of adjacent disk blocks
+typedef struct {
+    uint inum;
+    uint bno;  // block of the file
+    uchar data[BSIZE];
+} delayed;
+
+// runs of at least this many blocks writei() sends straight to the disk,
+// shorter ones go through the buffer cache and out with the command
+#define WRITE_DIRECT 8
+
+static delayed **held;
+static int nheld, cap, hooked;
+
+static delayed *find_delayed(uint inum, uint bno) {
+    for (int i = 0; i < nheld; ++i)
+        if (held[i]->inum == inum && held[i]->bno == bno) return held[i];
+    return NULL;
+}
+
+// have flush_disk() run iflush()
+static void ihook() {
+    if (!hooked) {
+        set_flush_hook(iflush);
+        hooked = 1;
     }
-    uchar buf[BSIZE];
-    read_block(IBLOCK(inum), buf);
-    dinode *dip = (dinode *)buf + inum % IPB;
-    if (dip->type == 0) {
-        Warn("iget: Inode %d not exist", inum);
-        return NULL;
+}
+
+static delayed *add_delayed(uint inum, uint bno) {
+    ihook();
+    if (nheld == cap) held = realloc(held, (cap = cap ? cap * 2 : NDELAYED) * sizeof(delayed *));
+    delayed *d = calloc(1, sizeof(delayed));  // the rest of a new block reads as zeros
+    d->inum = inum;
+    d->bno = bno;
+    held[nheld++] = d;
+    return d;
+}
+
+// forget the held blocks of inum from block bno on, 1 if there were any
+static int drop_delayed(uint inum, uint bno) {
+    int dropped = 0;
+    for (int i = 0; i < nheld; ++i)
+        if (held[i]->inum == inum && held[i]->bno >= bno) {
+            free(held[i]);
+            held[i--] = held[--nheld];
+            dropped = 1;
+        }
+    return dropped;
+}
+
+void idrop_delayed() {
+    for (int i = 0; i < nheld; ++i) free(held[i]);
+    nheld = 0;
+}
+
+// inodes in memory, hashed by inum, the unused ones also on a list in the
+// order they were put, most recent first
+#define NIBUCKET 1024
+
+static inode *ibucket[NIBUCKET];
+static inode *unused_head, *unused_tail;
+static int nunused;
+// changed since the last iflush()
+static inode **dirtyv;
+static int ndirty, dirtycap;
+static pthread_mutex_t icache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inode **ichain(uint inum) {
+    return &ibucket[inum % NIBUCKET];
+}
+
+static void unused_remove(inode *ip) {
+    if (ip->prev) ip->prev->next = ip->next; else unused_head = ip->next;
+    if (ip->next) ip->next->prev = ip->prev; else unused_tail = ip->prev;
+    nunused--;
+}
+
+static void unused_push(inode *ip) {
+    ip->prev = NULL;
+    ip->next = unused_head;
+    if (unused_head) unused_head->prev = ip; else unused_tail = ip;
+    unused_head = ip;
+    nunused++;
+}
+
+// the inode of inum in memory, NULL if it is not there
+static inode *ifind(uint inum) {
+    for (inode *ip = *ichain(inum); ip; ip = ip->hnext)
+        if (ip->inum == inum) return ip;
+    return NULL;
+}
+
+static void iunhash(inode *ip) {
+    inode **p = ichain(ip->inum);
+    while (*p != ip) p = &(*p)->hnext;
+    *p = ip->hnext;
+}
+
+static void ifree(inode *ip) {
+    pthread_mutex_destroy(&ip->lock);
+    free(ip);
+}
+
+// the inode of inum in memory with a reference taken, a new one if it is not
+// there, which the caller fills in
+static inode *iref(uint inum) {
+    inode *ip = ifind(inum);
+    if (ip) {
+        if (ip->ref++ == 0) unused_remove(ip);
+        return ip;
     }
-    inode *ip = calloc(1, sizeof(inode));
+    ip = calloc(1, sizeof(inode));
     ip->inum = inum;
+    ip->ref = 1;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ip->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    ip->hnext = *ichain(inum);
+    *ichain(inum) = ip;
+    return ip;
+}
+
+// the runs ip->map has are no longer what the file maps
+static void iforget(inode *ip) {
+    memset(ip->map, 0, sizeof(ip->map));
+    ip->nextmap = 0;
+}
+
+static void iload(inode *ip, const dinode *dip) {
     ip->type = dip->type;
     ip->mode = dip->mode;
     ip->uid = dip->uid;
@@ -29,77 +151,519 @@ inode *iget(uint inum) {
     ip->size = dip->size;
     ip->blocks = dip->blocks;
     memcpy(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    iforget(ip);
+}
+
+static void ilock(inode *ip) {
+    pthread_mutex_lock(&ip->lock);
+}
+
+static void iunlock(inode *ip) {
+    pthread_mutex_unlock(&ip->lock);
+}
+
+inode *iget(uint inum) {
+    if (inum < 0 || inum >= sb.ninodes) {
+        Warn("iget: Invaild inum %d", inum);
+        return NULL;
+    }
+    pthread_mutex_lock(&icache_lock);
+    inode *ip = ifind(inum) ? iref(inum) : NULL;
+    if (!ip) {
+        uchar buf[BSIZE];
+        read_block(IBLOCK(inum), buf);
+        dinode *dip = (dinode *)buf + inum % IPB;
+        if (dip->type != 0) iload(ip = iref(inum), dip);
+    }
+    pthread_mutex_unlock(&icache_lock);
+    if (!ip || ip->type == 0) {
+        Warn("iget: Inode %d not exist", inum);
+        iput(ip);
+        return NULL;
+    }
     return ip;
 }
 
-void iput(inode *ip) { free(ip); }
+void iput(inode *ip) {
+    if (!ip) return;
+    pthread_mutex_lock(&icache_lock);
+    if (--ip->ref == 0) {
+        if (ifind(ip->inum) != ip) {
+            ifree(ip);  // dropped by idrop_cache() while in use
+        } else {
+            unused_push(ip);
+            if (nunused > NICACHE) {
+                inode *old = unused_tail;
+                unused_remove(old);
+                iunhash(old);
+                ifree(old);
+            }
+        }
+    }
+    pthread_mutex_unlock(&icache_lock);
+}
+
+// ip changed, it is written on the next iflush(), called with the cache's lock held
+static void imark(inode *ip) {
+    if (ip->dirty) return;
+    ip->dirty = 1;
+    ip->ref++;
+    if (ndirty == dirtycap) dirtyv = realloc(dirtyv, (dirtycap = dirtycap ? dirtycap * 2 : 64) * sizeof(inode *));
+    dirtyv[ndirty++] = ip;
+}
+
+void idrop_cache() {
+    pthread_mutex_lock(&icache_lock);
+    for (int i = 0; i < ndirty; ++i) {
+        dirtyv[i]->dirty = 0;
+        if (--dirtyv[i]->ref == 0) unused_push(dirtyv[i]);
+    }
+    ndirty = 0;
+    while (unused_tail) {
+        inode *ip = unused_tail;
+        unused_remove(ip);
+        ifree(ip);
+    }
+    // those in use are freed by their last iput()
+    memset(ibucket, 0, sizeof(ibucket));
+    pthread_mutex_unlock(&icache_lock);
+}
 
 inode *ialloc(short type) {
+    return ialloc_group(type, 0);
+}
+
+inode *ialloc_group(short type, uint g) {
     uchar buf[BSIZE];
-    for(int i = 0; i < sb.ninodes; ++i){
-        read_block(IBLOCK(i), buf);
+    uint first = g * IPG % sb.ninodes, have = 0;  // no inode is in block 0
+    pthread_mutex_lock(&icache_lock);
+    for(uint k = 0; k < sb.ninodes; ++k){
+        uint i = (first + k) % sb.ninodes;
+        inode *ip = ifind(i);
+        if (ip && ip->type != 0) continue;  // in use, whatever its block says
+        if (IBLOCK(i) != have) read_block(have = IBLOCK(i), buf);
         dinode *dip = (dinode *)buf + i % IPB;
         if (dip->type == 0) {
-            memset(dip, 0, sizeof(dinode));
-            dip->type = type;
-            write_block(IBLOCK(i), buf);
-            inode *ip = calloc(1, sizeof(inode));
-            ip->inum = i;
-            ip->type = type;
+            dinode fresh = {.type = type};
+            iload(ip = iref(i), &fresh);
+            imark(ip);
+            ihook();
+            pthread_mutex_unlock(&icache_lock);
             return ip;
         }
     }
+    pthread_mutex_unlock(&icache_lock);
     Error("ialloc: no free inodes");
     return NULL;
 }
 
 void iupdate(inode *ip) {
-    uchar buf[BSIZE];
-    read_block(IBLOCK(ip->inum), buf);
-    dinode *dip = (dinode *)buf + ip->inum % IPB;
+    ilock(ip);
+    ip->mtime = time(NULL);
+    pthread_mutex_lock(&icache_lock);
+    imark(ip);
+    pthread_mutex_unlock(&icache_lock);
+    iunlock(ip);
+    ihook();
+}
+
+static void istore(const inode *ip, dinode *dip) {
     dip->type = ip->type;
     dip->mode = ip->mode;
     dip->uid = ip->uid;
     dip->links = ip->links;
-    dip->mtime = ip->mtime = time(NULL);
+    dip->mtime = ip->mtime;
     dip->size = ip->size;
     dip->blocks = ip->blocks;
     memcpy(dip->addrs, ip->addrs, sizeof(ip->addrs));
-    write_block(IBLOCK(ip->inum), buf);
 }
 
-int readi(inode *ip, uchar *dst, uint off, uint n) {
+static int by_iblock(const void *a, const void *b) {
+    uint x = IBLOCK((*(inode *const *)a)->inum), y = IBLOCK((*(inode *const *)b)->inum);
+    return x < y ? -1 : x > y;
+}
+
+// write every inode changed since the last time, each inode block once
+static void iflush_dirty() {
+    pthread_mutex_lock(&icache_lock);
+    inode **v = dirtyv;
+    int n = ndirty;
+    dirtyv = NULL;
+    ndirty = dirtycap = 0;
+    pthread_mutex_unlock(&icache_lock);
+    qsort(v, n, sizeof(inode *), by_iblock);
+    uchar buf[BSIZE];
+    for (int i = 0, j; i < n; i = j) {
+        uint bno = IBLOCK(v[i]->inum);
+        for (j = i; j < n && IBLOCK(v[j]->inum) == bno; ++j);
+        // the inodes of the block that did not change are as it has them
+        if (j - i < IPB) read_block(bno, buf);
+        for (int k = i; k < j; ++k) {
+            ilock(v[k]);
+            v[k]->dirty = 0;  // a change from here on marks it again
+            istore(v[k], (dinode *)buf + v[k]->inum % IPB);
+            iunlock(v[k]);
+        }
+        write_block(bno, buf);
+    }
+    for (int i = 0; i < n; ++i) iput(v[i]);
+    free(v);
+}
+
+// read_block() and write_block() of an indirect block, counted as one (iotrace.h)
+static void read_indirect(uint bno, uchar *buf) {
+    int cls = io_class(IO_INDIRECT);
+    read_block(bno, buf);
+    io_class(cls);
+}
+
+static void write_indirect(uint bno, uchar *buf) {
+    int cls = io_class(IO_INDIRECT);
+    write_block(bno, buf);
+    io_class(cls);
+}
+
+// the class of the blocks of ip
+static int data_class(inode *ip) {
+    return ip->type == T_DIR ? IO_DIR : IO_DATA;
+}
+
+// of the n disk blocks in a, those from a[i] on that are a run
+static uint run(const uint *a, uint i, uint n) {
+    uint len = 1;
+    while (i + len < n && a[i + len] == a[i] + len) len++;
+    return len;
+}
+
+// disk block of block bno of a file mapped through indirect blocks, 0 if it
+// has none, else *len blocks from there on are a run in the same block of
+// addresses
+static uint ipeek_indirect(inode *ip, uint bno, uint *len) {
+    uchar buf[BSIZE];
+    if (bno < NDIRECT) {
+        *len = run(ip->addrs, bno, NDIRECT);
+        return ip->addrs[bno];
+    }
+    uint saddr;
+    if (bno < NDIRECT + APB) {
+        bno -= NDIRECT;
+        saddr = ip->addrs[NDIRECT];
+    } else if (bno < MAXFILEB) {
+        bno -= NDIRECT + APB;
+        if (!ip->addrs[NDIRECT + 1]) return 0;
+        read_indirect(ip->addrs[NDIRECT + 1], buf);
+        saddr = ((uint *)buf)[bno / APB];
+        bno %= APB;
+    } else {
+        return 0;
+    }
+    if (!saddr) return 0;
+    read_indirect(saddr, buf);
+    *len = run((uint *)buf, bno, APB);
+    return ((uint *)buf)[bno];
+}
+
+// disk block of block bno of the file, 0 if it has none, allocates nothing.
+// The run it is in goes in ip->map, which maps the blocks after it as well
+// without reading an indirect or extent block again
+static uint ipeekblock(inode *ip, uint bno) {
+    for (int i = 0; i < NL2P; ++i)
+        if (bno - ip->map[i].bno < ip->map[i].len) return ip->map[i].addr + (bno - ip->map[i].bno);
+    uint len;
+    uint addr = ip->mode & M_EXTENT ? extent_map(ip, bno, &len) : ipeek_indirect(ip, bno, &len);
+    if (addr) {
+        ip->map[ip->nextmap] = (l2p){bno, addr, len};
+        ip->nextmap = (ip->nextmap + 1) % NL2P;
+    }
+    return addr;
+}
+
+// map block bno of the file to disk block addr, allocating indirect blocks on the way
+static void isetblock(inode *ip, uint bno, uint addr) {
     uchar buf[BSIZE];
-    if (off > ip->size || off + n < off) return -1;
+    if (bno < NDIRECT) {
+        ip->addrs[bno] = addr;
+        return;
+    }
+    uint saddr;
+    if (bno < NDIRECT + APB) {
+        bno -= NDIRECT;
+        if (!ip->addrs[NDIRECT]) ip->addrs[NDIRECT] = allocate_block_in(IGROUP(ip->inum));
+        saddr = ip->addrs[NDIRECT];
+    } else {
+        bno -= NDIRECT + APB;
+        uint daddr = ip->addrs[NDIRECT + 1];
+        if (!daddr) daddr = ip->addrs[NDIRECT + 1] = allocate_block_in(IGROUP(ip->inum));
+        read_indirect(daddr, buf);
+        uint *addrs = (uint *)buf;
+        if (!addrs[bno / APB]) {
+            addrs[bno / APB] = allocate_block_in(IGROUP(ip->inum));
+            write_indirect(daddr, buf);
+        }
+        saddr = addrs[bno / APB];
+        bno %= APB;
+    }
+    read_indirect(saddr, buf);
+    ((uint *)buf)[bno] = addr;
+    write_indirect(saddr, buf);
+}
+
+// map the n blocks of the file from bno on to the disk blocks from addr on
+static void isetrun(inode *ip, uint bno, uint addr, uint n) {
+    iforget(ip);
+    if (ip->mode & M_EXTENT) {
+        extent_set(ip, bno, addr, n);
+        return;
+    }
+    for (uint i = 0; i < n; ++i) isetblock(ip, bno + i, addr + i);
+}
+
+static int by_bno(const void *a, const void *b) {
+    uint x = (*(delayed *const *)a)->bno, y = (*(delayed *const *)b)->bno;
+    return x < y ? -1 : x > y;
+}
+
+// give the held blocks of ip disk blocks, adjacent ones where the free map
+// allows, write them and update ip
+static void iallocate_delayed(inode *ip) {
+    delayed **mine = malloc((nheld + 1) * sizeof(delayed *));
+    int n = 0;
+    for (int i = 0; i < nheld; ++i)
+        if (held[i]->inum == ip->inum) {
+            mine[n++] = held[i];
+            held[i--] = held[--nheld];
+        }
+    if (n == 0) {
+        free(mine);
+        return;
+    }
+    qsort(mine, n, sizeof(delayed *), by_bno);
+    ilock(ip);
+    int total = n;
+    // all data runs first, the blocks of the mapping isetrun() needs come after them
+    uint *addr = malloc((n + 1) * sizeof(uint));
+    uchar *buf = malloc((n + 1) * BSIZE);
+    int cls = io_class(data_class(ip));
+    for (int i = 0, len; i < n; i += len) {
+        uint first = allocate_run(IGROUP(ip->inum), n - i, (uint *)&len);
+        if (len == 0) {
+            Error("iallocate_delayed: out of blocks, inode %u loses %d blocks", ip->inum, n - i);
+            n = i;
+            break;
+        }
+        for (int j = 0; j < len; ++j) {
+            addr[i + j] = first + j;
+            memcpy(buf + j * BSIZE, mine[i + j]->data, BSIZE);
+        }
+        write_blocks(first, len, buf);
+    }
+    io_class(cls);
+    for (int i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && mine[j]->bno == mine[i]->bno + (j - i) && addr[j] == addr[i] + (j - i); ++j);
+        isetrun(ip, mine[i]->bno, addr[i], j - i);
+    }
+    iupdate(ip);
+    iunlock(ip);
+    for (int i = 0; i < total; ++i) free(mine[i]);
+    free(buf);
+    free(addr);
+    free(mine);
+}
+
+static void iflush_delayed() {
+    while (nheld > 0) {
+        uint inum = held[0]->inum;
+        inode *ip = iget(inum);
+        if (ip) {
+            iallocate_delayed(ip);
+            iput(ip);
+        } else {
+            drop_delayed(inum, 0);
+        }
+    }
+}
+
+void iflush() {
+    iflush_delayed();
+    iflush_dirty();
+}
+
+// sequential readers: a readi() starting where the inode's last one ended
+// reads ahead, twice as far as the last time up to RA_MAX blocks, one from
+// the start of the file RA_MIN blocks, any other none
+#define NREADER 16
+#define RA_MIN 4
+#define RA_MAX 64
+
+typedef struct {
+    uint inum;
+    uint next;    // block a sequential read starts at
+    uint window;  // blocks read ahead, 0 if not sequential
+} reader;
+
+static reader readers[NREADER];
+static int nreader, oldest;
+
+static reader *find_reader(uint inum) {
+    for (int i = 0; i < nreader; ++i)
+        if (readers[i].inum == inum) return &readers[i];
+    reader *r = nreader < NREADER ? &readers[nreader++] : &readers[oldest++ % NREADER];
+    *r = (reader){inum, 0, 0};
+    return r;
+}
+
+// read blocks [from, from + n) of the file into the buffer cache in the
+// background, in runs of adjacent disk blocks
+static void iread_ahead(inode *ip, uint from, uint n) {
+    uchar tmp[BSIZE];
+    uint run = 0, len = 0;
+    for (uint i = from; i < from + n && i * BSIZE < ip->size; ++i) {
+        uint addr = find_delayed(ip->inum, i) ? 0 : ipeekblock(ip, i);
+        if (addr && bcache_peek(addr, tmp) == 0) addr = 0;
+        if (len && addr == run + len) {
+            len++;
+            continue;
+        }
+        read_ahead(run, len);
+        run = addr;
+        len = addr ? 1 : 0;
+    }
+    read_ahead(run, len);
+}
+
+int readi(inode *ip, uchar *dst, uint off, uint n) {
+    ilock(ip);
+    if (off > ip->size || off + n < off) {
+        iunlock(ip);
+        return -1;
+    }
     if (off + n > ip->size) n = ip->size - off;
+    if (n == 0) {
+        iunlock(ip);
+        return 0;
+    }
+
+    // what earlier calls read ahead is in the buffer cache by now
+    read_ahead_wait();
+    int cls = io_class(data_class(ip));
 
-    for (uint tot = 0, m; tot < n; tot += m, off += m, dst += m) {
-        read_block(imapblock(ip, off / BSIZE), buf);
-        m = min(n - tot, BSIZE - off % BSIZE);
-        memcpy(dst, buf + off % BSIZE, m);
+    // map the whole range, taking what the buffer cache has, and start reading
+    // each run of the rest as soon as it ends, the disk servers work on it
+    // while the rest is mapped
+    uint bno = off / BSIZE, last = (off + n - 1) / BSIZE;
+    uchar *buf = malloc((last - bno + 1) * BSIZE);
+    bio **bios = malloc((last - bno + 1) * sizeof(bio *));
+    int nbio = 0;
+    uint run = 0, len = 0;  // the run being built, its first disk block and length
+    uchar *runbuf = NULL;
+    for (uint i = bno; i <= last; ++i) {
+        uchar *p = buf + (i - bno) * BSIZE;
+        delayed *d = find_delayed(ip->inum, i);
+        uint addr = 0;
+        if (d)
+            memcpy(p, d->data, BSIZE);  // not on disk yet
+        else if (!(addr = ipeekblock(ip, i)))
+            memset(p, 0, BSIZE);  // a hole reads as zeros and stays one
+        else if (bcache_get(addr, p) == 0)
+            addr = 0;
+        // extend the run while the blocks are also contiguous on disk
+        if (len && addr == run + len) {
+            len++;
+            continue;
+        }
+        if (len) bios[nbio++] = bio_submit(BDS_OP_READ, run, len, runbuf, NULL, NULL);
+        len = 0;
+        if (addr) {
+            run = addr;
+            len = 1;
+            runbuf = p;
+        }
     }
+    if (len) bios[nbio++] = bio_submit(BDS_OP_READ, run, len, runbuf, NULL, NULL);
+
+    reader *r = find_reader(ip->inum);
+    if (bno == 0 || bno != r->next)
+        r->window = bno == 0 ? RA_MIN : 0;  // reading from the start counts as sequential
+    else
+        r->window = r->window ? min(2 * r->window, RA_MAX) : RA_MIN;
+    r->next = last + 1;
+    if (r->window) iread_ahead(ip, last + 1, r->window);
+
+    if (bio_wait_all(bios, nbio) != BDS_OK) Error("readi: error reading inode %u", ip->inum);
+    io_class(cls);
+    iunlock(ip);
+    memcpy(dst, buf + off % BSIZE, n);
+    free(bios);
+    free(buf);
     return n;
 }
 
+// the part of block k of a range of n bytes from off that the range covers
+static void span(uint off, uint n, uint k, uint *from, uint *to) {
+    uint first = off / BSIZE, last = (off + n - 1) / BSIZE;
+    *from = k == 0 ? off % BSIZE : 0;
+    *to = first + k == last ? (off + n - 1) % BSIZE + 1 : BSIZE;
+}
+
 int writei(inode *ip, uchar *src, uint off, uint n) {
-    uchar buf[BSIZE];
-    if (off > ip->size || off + n < off)  // off is larger than size || off overflow
+    ilock(ip);
+    // off is larger than size, off overflows or the file gets too large
+    if (off > ip->size || off + n < off || (!(ip->mode & M_EXTENT) && off + n > MAXFILEB * BSIZE)) {
+        iunlock(ip);
         return -1;
-    if (off + n > MAXFILEB * BSIZE) return -1;  // too large
+    }
+    int cls = io_class(data_class(ip));
 
-    for (uint tot = 0, m; tot < n; tot += m, off += m, src += m) {
-        read_block(imapblock(ip, off / BSIZE), buf);
-        m = min(n - tot, BSIZE - off % BSIZE);
-        memcpy(buf + off % BSIZE, src, m);
-        write_block(imapblock(ip, off / BSIZE), buf);
+    // blocks without a disk block yet are held back, see iflush(). The others
+    // are mapped first, those written in part read at once, and each run of
+    // them adjacent on disk goes out in one request
+    uint nb = n ? (off + n - 1) / BSIZE - off / BSIZE + 1 : 0, from, to;
+    uchar *buf = malloc(nb * BSIZE);
+    uint *addr = malloc((nb + 1) * sizeof(uint));
+    bio *bios[2];  // only the first and last block can be written in part
+    int nbio = 0;
+    for (uint k = 0; k < nb; ++k) {
+        uint bno = off / BSIZE + k;
+        span(off, n, k, &from, &to);
+        delayed *d = find_delayed(ip->inum, bno);
+        addr[k] = d ? 0 : ipeekblock(ip, bno);
+        if (!d && !addr[k]) {
+            if (nheld >= NDELAYED) iflush_delayed();  // every file's, ip's alone may be few
+            d = add_delayed(ip->inum, bno);
+        }
+        if (d)
+            memcpy(d->data + from, src + k * BSIZE + from - off % BSIZE, to - from);
+        else if (to - from < BSIZE && bcache_get(addr[k], buf + k * BSIZE) < 0)
+            bios[nbio++] = bio_submit(BDS_OP_READ, addr[k], 1, buf + k * BSIZE, NULL, NULL);
+    }
+    if (bio_wait_all(bios, nbio) != BDS_OK) Error("writei: error reading inode %u", ip->inum);
+    for (uint k = 0; k < nb; ++k) {
+        span(off, n, k, &from, &to);
+        if (addr[k]) memcpy(buf + k * BSIZE + from, src + k * BSIZE + from - off % BSIZE, to - from);
+    }
+    bio **wbios = malloc((nb + 1) * sizeof(bio *));
+    int nw = 0;
+    for (uint k = 0, len; k < nb; k += len) {
+        for (len = 1; k + len < nb && addr[k] && addr[k + len] == addr[k] + len; ++len);
+        if (!addr[k]) continue;
+        if (len < WRITE_DIRECT)
+            for (uint j = 0; j < len; ++j) write_block(addr[k] + j, buf + (k + j) * BSIZE);
+        else
+            wbios[nw++] = bio_submit(BDS_OP_WRITE, addr[k], len, buf + k * BSIZE, NULL, NULL);
     }
+    if (bio_wait_all(wbios, nw) != BDS_OK) Error("writei: error writing inode %u", ip->inum);
+    io_class(cls);
+    free(wbios);
+    free(addr);
+    free(buf);
 
-    if (n > 0 && off > ip->size) {  // size is larger
-        ip->size = off;
-        ip->blocks = max(1 + (off - 1) / BSIZE, ip->blocks);  // blocks may change
+    if (n > 0 && off + n > ip->size) {  // size is larger
+        ip->size = off + n;
+        ip->blocks = max(1 + (ip->size - 1) / BSIZE, ip->blocks);  // blocks may change
     }
     ip->mtime = time(NULL);
     iupdate(ip);
+    iunlock(ip);
     return n;
 }
 
@@ -111,20 +675,50 @@ int checkIp(inode *ip){
 }
 
 int itest(inode *ip) {
+    ilock(ip);
     int true_blocks = 1 + (ip->size - 1) / BSIZE;
     if (true_blocks <= ip->blocks / 2) {
         Log("Block usage: %d/%d, recycle", true_blocks, ip->blocks);
-        for(int i = ip->blocks - 1; i > true_blocks; --i) free_block(imapblock(ip, i));
+        if (ip->mode & M_EXTENT) {
+            drop_delayed(ip->inum, true_blocks);
+            extent_trunc(ip, true_blocks);
+        } else {
+            // unmapped too, a later write past the end must not reuse them
+            for (int i = ip->blocks - 1; i >= true_blocks; --i) {
+                uint addr = drop_delayed(ip->inum, i) ? 0 : ipeekblock(ip, i);
+                if (!addr) continue;
+                free_block(addr);
+                isetblock(ip, i, 0);
+            }
+        }
+        iforget(ip);
         ip->blocks = true_blocks;
         iupdate(ip);
     }
+    iunlock(ip);
     return 0;
 }
 
+// group for a new inode: a file goes next to its directory, a directory
+// spreads out to the group with the most free blocks, the root stays in 0
+static uint place(short type, char *name, uint pinum) {
+    if (!name) return 0;
+    if (type != T_DIR) return IGROUP(pinum);
+    uint best = IGROUP(pinum), nfree = cg_free(best);
+    for (uint g = 0; g < cg_count(); ++g)
+        if (cg_free(g) > nfree) {
+            best = g;
+            nfree = cg_free(g);
+        }
+    return best;
+}
+
 int icreate(short type, char *name, uint pinum, ushort uid, ushort perm) {
-    inode *ip = ialloc(type);
+    inode *ip = ialloc_group(type, place(type, name, pinum));
     checkIp(ip);
-    ip->mode = perm;
+    // a directory grows an entry at a time, each of its blocks lands apart and
+    // would be an extent of its own, its few blocks are cheaper to map directly
+    ip->mode = perm | (type == T_DIR ? 0 : M_EXTENT);
     ip->uid = uid;
     ip->links = 1;
     ip->size = 0;
@@ -156,7 +750,8 @@ int icreate(short type, char *name, uint pinum, ushort uid, ushort perm) {
     return 0;
 }
 
-void itrunc(inode *ip) {
+// free the blocks of a file mapped through indirect blocks, and its indirect blocks
+static void itrunc_indirect(inode *ip) {
     uchar buf[BSIZE];
     for(int i = 0; i < NDIRECT; ++i)
         if (ip->addrs[i]) {
@@ -165,7 +760,7 @@ void itrunc(inode *ip) {
         }
 
     if (ip->addrs[NDIRECT]) {
-        read_block(ip->addrs[NDIRECT], buf);
+        read_indirect(ip->addrs[NDIRECT], buf);
         uint *addrs = (uint *)buf;
         for(int i = 0; i < APB; ++i)
             if(addrs[i]) free_block(addrs[i]);
@@ -174,70 +769,53 @@ void itrunc(inode *ip) {
     }
 
     if (ip->addrs[NDIRECT + 1]) {
-        read_block(ip->addrs[NDIRECT + 1], buf);
+        read_indirect(ip->addrs[NDIRECT + 1], buf);
         uint *addrs = (uint *)buf;
-        uchar buf2[BSIZE];
+        // every indirect block the cache does not have is read at once
+        uchar *ind = malloc(APB * BSIZE);
+        bio *bios[APB];
+        int nbio = 0, cls = io_class(IO_INDIRECT);
+        for(int i = 0; i < APB; ++i)
+            if(addrs[i] && bcache_get(addrs[i], ind + i * BSIZE) < 0)
+                bios[nbio++] = bio_submit(BDS_OP_READ, addrs[i], 1, ind + i * BSIZE, NULL, NULL);
+        io_class(cls);
+        if (bio_wait_all(bios, nbio) != BDS_OK) Error("itrunc: error reading indirect blocks of inode %u", ip->inum);
         for(int i = 0; i < APB; ++i) {
             if(addrs[i]) {
-                read_block(addrs[i], buf2);
-                uint *addrs2 = (uint *)buf2;
+                uint *addrs2 = (uint *)(ind + i * BSIZE);
                 for(int j = 0; j < APB; ++j)
                     if (addrs2[j]) free_block(addrs2[j]);
                 free_block(addrs[i]);
             }
         }
+        free(ind);
         free_block(ip->addrs[NDIRECT + 1]);
         ip->addrs[NDIRECT + 1] = 0;
     }
+}
 
+void itrunc(inode *ip) {
+    ilock(ip);
+    drop_delayed(ip->inum, 0);
+    if (ip->mode & M_EXTENT)
+        extent_trunc(ip, 0);
+    else
+        itrunc_indirect(ip);
+    iforget(ip);
     ip->size = 0;
     ip->blocks = 0;
     iupdate(ip);
+    iunlock(ip);
 }
 
 int imapblock(inode *ip, uint bno) {
-    uchar buf[BSIZE];
-    uint addr;
-    if (bno < NDIRECT) {
-        addr = ip->addrs[bno];
-        if (!addr) addr = ip->addrs[bno] = allocate_block();
-        return addr;
-    } else if (bno < NDIRECT + APB) {
-        bno -= NDIRECT;
-        uint saddr = ip->addrs[NDIRECT];  // single addr
-        if (!saddr) saddr = ip->addrs[NDIRECT] = allocate_block();
-        read_block(saddr, buf);
-        uint *addrs = (uint *)buf;
-        addr = addrs[bno];
-        if (!addr) {
-            addr = addrs[bno] = allocate_block();
-            write_block(saddr, buf);
-        }
-        return addr;
-    } else if (bno < MAXFILEB) {
-        bno -= NDIRECT + APB;
-        uint a = bno / APB, b = bno % APB;
-        uint daddr = ip->addrs[NDIRECT + 1];  // double addr
-        if (!daddr) daddr = ip->addrs[NDIRECT + 1] = allocate_block();
-        read_block(daddr, buf);
-        uint *addrs = (uint *)buf;
-
-        uint saddr = addrs[a];  // single addr
-        if (!saddr) {
-            saddr = addrs[a] = allocate_block();
-            write_block(daddr, buf);
-        }
-        read_block(saddr, buf);
-        addrs = (uint *)buf;
-
-        addr = addrs[b];
-        if (!addr) {
-            addr = addrs[b] = allocate_block();
-            write_block(saddr, buf);
-        }
-        return addr;
-    } else {
+    uint addr = ipeekblock(ip, bno);
+    if (addr) return addr;
+    if (!(ip->mode & M_EXTENT) && bno >= MAXFILEB) {
         Warn("imapblock: bno too large");
         return 0;
     }
+    addr = allocate_block_in(IGROUP(ip->inum));
+    if (addr) isetrun(ip, bno, addr, 1);
+    return addr;
 }
@@ -0,0 +1,126 @@
+#include "iotrace.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "block.h"
+#include "log.h"
+
+static const char *names[] = {"superblock", "bitmap", "inode", "indirect", "directory", "data"};
+
+static iotrace_counters counters[IO_NCLASS][2];
+
+static __thread int current = IO_DATA;
+
+int io_class(int cls) {
+    int prev = current;
+    current = cls;
+    return prev;
+}
+
+int iotrace_class(uint blockno) {
+    if (blockno == 0) return IO_SUPER;  // also before there is a superblock to go by
+    if (blockno < sb.size) {
+        uint k = blockno % CGSIZE;
+        if (k == 0) return IO_SUPER;
+        if (k < sb.inodestart) return IO_BITMAP;  // checksum blocks only go out raw
+        if (k < sb.datastart) return IO_INODE;
+    }
+    return current;
+}
+
+// 0-3 ns on their own, then 4 buckets for each power of two
+static int bucket(long ns) {
+    if (ns < 4) return ns > 0 ? ns : 0;
+    int e = 63 - __builtin_clzl(ns);
+    int b = 4 * (e - 1) + (ns >> (e - 2) & 3);
+    return b < IO_BUCKETS ? b : IO_BUCKETS - 1;
+}
+
+// upper edge of bucket b
+static long bucket_end(int b) {
+    if (b < 4) return b + 1;
+    int e = b / 4 + 1;
+    return (long)(4 + b % 4 + 1) << (e - 2);
+}
+
+void iotrace_record(int cls, int op, int n, long ns) {
+    if (cls < 0 || cls >= IO_NCLASS) cls = IO_DATA;
+    iotrace_counters *c = &counters[cls][op == IO_WRITE];
+    __atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->blocks, n, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->hist[bucket(ns)], 1, __ATOMIC_RELAXED);
+}
+
+void iotrace_reset() {
+    for (int cls = 0; cls < IO_NCLASS; ++cls)
+        for (int op = 0; op < 2; ++op) {
+            iotrace_counters *c = &counters[cls][op];
+            __atomic_store_n(&c->calls, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->blocks, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->ns, 0, __ATOMIC_RELAXED);
+            for (int b = 0; b < IO_BUCKETS; ++b) __atomic_store_n(&c->hist[b], 0, __ATOMIC_RELAXED);
+        }
+}
+
+void iotrace_stats(int cls, int op, iotrace_counters *c) {
+    iotrace_counters *from = &counters[cls][op == IO_WRITE];
+    c->calls = __atomic_load_n(&from->calls, __ATOMIC_RELAXED);
+    c->blocks = __atomic_load_n(&from->blocks, __ATOMIC_RELAXED);
+    c->ns = __atomic_load_n(&from->ns, __ATOMIC_RELAXED);
+    for (int b = 0; b < IO_BUCKETS; ++b) c->hist[b] = __atomic_load_n(&from->hist[b], __ATOMIC_RELAXED);
+}
+
+long iotrace_percentile(const iotrace_counters *c, double q) {
+    long total = 0;
+    for (int b = 0; b < IO_BUCKETS; ++b) total += c->hist[b];
+    if (total == 0) return 0;
+    long want = ceil(q * total), seen = 0;
+    for (int b = 0; b < IO_BUCKETS; ++b) {
+        seen += c->hist[b];
+        if (seen >= want) return bucket_end(b);
+    }
+    return 0;
+}
+
+// append to buf like snprintf, never past size
+static void append(char *buf, int size, int *len, const char *fmt, ...) {
+    if (*len >= size - 1) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    *len = *len + n < size ? *len + n : size - 1;
+}
+
+int iotrace_format(char *buf, int size) {
+    int len = 0;
+    buf[0] = 0;
+    append(buf, size, &len, "%-10s %8s %8s %8s %8s %8s %8s %8s %8s\n", "class", "reads", "blocks", "p50 us",
+           "p99 us", "writes", "blocks", "p50 us", "p99 us");
+    long total[2] = {0, 0};
+    for (int cls = 0; cls < IO_NCLASS; ++cls) {
+        append(buf, size, &len, "%-10s", names[cls]);
+        for (int op = 0; op < 2; ++op) {
+            iotrace_counters c;
+            iotrace_stats(cls, op, &c);
+            append(buf, size, &len, " %8ld %8ld %8.1f %8.1f", c.calls, c.blocks, iotrace_percentile(&c, 0.5) / 1e3,
+                   iotrace_percentile(&c, 0.99) / 1e3);
+            total[op] += c.calls;
+        }
+        append(buf, size, &len, "\n");
+    }
+    append(buf, size, &len, "%ld reads, %ld writes\n", total[IO_READ], total[IO_WRITE]);
+    return len;
+}
+
+void iotrace_report() {
+    char buf[2048];
+    iotrace_format(buf, sizeof(buf));
+    Log("Block I/O by caller:");
+    char *save;
+    for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) Log("  %s", line);
+}
@@ -2,10 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "bcache.h"
 #include "block.h"
 #include "common.h"
 #include "fs.h"
+#include "iotrace.h"
 #include "log.h"
 
 // global variables
@@ -255,22 +258,56 @@ int handle_login(char *args) {
     return 0;
 }
 
+int handle_io(char *args) {
+    // io [reset]
+    static char buf[2048];
+    ParseArgs(1);
+    int reset = argc == 1 && strcmp(argv[0], "reset") == 0;
+    iotrace_format(buf, sizeof(buf));
+    if (reset) iotrace_reset();
+    printf("%s", buf);
+    Log("Block I/O by caller%s\n%s", reset ? ", reset" : "", buf);
+    return 0;
+}
+
 static struct {
     const char *name;
     int (*handler)(char *);
 } cmd_table[] = {{"f", handle_f},        {"mk", handle_mk},       {"mkdir", handle_mkdir}, {"rm", handle_rm},
                  {"cd", handle_cd},      {"rmdir", handle_rmdir}, {"ls", handle_ls},       {"cat", handle_cat},
                  {"w", handle_w},        {"i", handle_i},         {"d", handle_d},         {"e", handle_e},
-                 {"login", handle_login}};
+                 {"login", handle_login}, {"io", handle_io}};
 
 #define NCMD (sizeof(cmd_table) / sizeof(cmd_table[0]))
 
 FILE *log_file;
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    int policy = BC_LRU, nblocks = BCACHE_SIZE, scrub_ms = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (bcache_parse(optarg, &policy, &nblocks) < 0) {
+                fprintf(stderr, "Unknown buffer cache '%s', use lru|fifo|clock[:blocks] or off\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            scrub_ms = atoi(optarg);
+            if (scrub_ms <= 0) {
+                fprintf(stderr, "Invalid scrub interval '%s', use milliseconds\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            argc = 0;  // print usage
+        }
+    }
+    if (argc - optind < 1) {
         fprintf(stderr,
-                "Usage: %s <BDSPort>>\n",
+                "Usage: %s [-c lru|fifo|clock[:blocks]|off] [-s scrub ms] "
+                "<BDSPort | raid0[:unit]:port,... | raid1:port,... | raid10[:unit]:port,... | file:image[:ncyl:nsec]>\n",
                 argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -279,14 +316,19 @@ int main(int argc, char *argv[]) {
 
     assert(BSIZE % sizeof(dinode) == 0);
 
-    diskseverinit(atoi(argv[1]));
-    Log("Connected to disk server");
+    bcache_init(policy, nblocks, NULL);
+    if (diskarrayinit(argv[optind]) < 0) {
+        fprintf(stderr, "Cannot reach disk '%s'\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    Log("Connected to disk %s", argv[optind]);
 
     // get disk info and store in global variables
     get_disk_info(&ncyl, &nsec);
 
     // read the superblock
     sbinit();
+    scrub_start(scrub_ms);
 
     static char buf[4096];
     while (1) {
@@ -294,19 +336,27 @@ int main(int argc, char *argv[]) {
         if (feof(stdin)) break;
         buf[strlen(buf) - 1] = 0;
         Log("Use command: %s", buf);
+        char *end = buf + strlen(buf);
         char *p = strtok(buf, " ");
         int ret = 1;
         for (int i = 0; i < NCMD; i++)
             if (p && strcmp(p, cmd_table[i].name) == 0) {
-                ret = cmd_table[i].handler(p + strlen(p) + 1);
+                // the arguments, an empty string rather than past the line without any
+                char *args = p + strlen(p);
+                ret = cmd_table[i].handler(args < end ? args + 1 : args);
                 break;
             }
         if (ret == 1) {
             Log("No such command");
             printf("No\n");
         }
+        flush_disk();
         if (ret < 0) break;
     }
 
+    diskarrayclose();
+    bcache_report();
+    csum_report();
+    iotrace_report();
     log_close();
 }
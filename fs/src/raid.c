@@ -0,0 +1,93 @@
+#include "raid.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *names[] = {"", "raid0", "raid1", "raid10"};
+
+int raid_parse(const char *spec, raid_layout *l, int *ports) {
+    l->level = RAID_SINGLE;
+    l->unit = RAID_UNIT;
+    l->ndisk = 0;
+    const char *p = spec;
+    int len = strcspn(p, ":");
+    if (p[len] == ':') {
+        for (l->level = RAID_10; l->level > RAID_SINGLE; --l->level)
+            if (strlen(names[l->level]) == len && strncmp(p, names[l->level], len) == 0) break;
+        if (l->level == RAID_SINGLE) return -1;
+        p += len + 1;
+        len = strcspn(p, ":");
+        if (p[len] == ':') {
+            if (l->level == RAID_1) return -1;  // nothing to stripe
+            l->unit = atoi(p);
+            if (l->unit <= 0) return -1;
+            p += len + 1;
+        }
+    }
+    // comma separated ports
+    while (*p) {
+        if (l->ndisk == RAID_MAXDISK) return -1;
+        char *end;
+        long port = strtol(p, &end, 10);
+        if (end == p || port <= 0 || port > 65535 || (*end && *end != ',')) return -1;
+        ports[l->ndisk++] = port;
+        p = *end ? end + 1 : end;
+    }
+    switch (l->level) {
+    case RAID_SINGLE:
+        return l->ndisk == 1 ? 0 : -1;
+    case RAID_10:
+        return l->ndisk >= 2 && l->ndisk % 2 == 0 ? 0 : -1;
+    default:
+        return l->ndisk >= 1 ? 0 : -1;
+    }
+}
+
+// disks data is striped over, one per mirrored pair for RAID_10
+static int nstripe(const raid_layout *l) {
+    switch (l->level) {
+    case RAID_0:
+        return l->ndisk;
+    case RAID_10:
+        return l->ndisk / 2;
+    default:
+        return 1;
+    }
+}
+
+uint raid_capacity(const raid_layout *l, uint disk_blocks) {
+    if (l->level == RAID_0 || l->level == RAID_10) {
+        // whole stripe units only, a partial one at the end of a disk would not line up
+        return (disk_blocks / l->unit) * l->unit * nstripe(l);
+    }
+    return disk_blocks;
+}
+
+int raid_ncopies(const raid_layout *l) {
+    switch (l->level) {
+    case RAID_1:
+        return l->ndisk;
+    case RAID_10:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+int raid_map(const raid_layout *l, uint b, int c, uint *pblock) {
+    if (l->level == RAID_SINGLE || l->level == RAID_1) {
+        *pblock = b;
+        return c;
+    }
+    uint stripe = b / l->unit;
+    int n = nstripe(l);
+    *pblock = (stripe / n) * l->unit + b % l->unit;
+    int disk = stripe % n;
+    // RAID_10 pairs are disks 2k and 2k + 1
+    return l->level == RAID_10 ? disk * 2 + c : disk;
+}
+
+uint raid_extent(const raid_layout *l, uint b) {
+    if (l->level == RAID_0 || l->level == RAID_10) return l->unit - b % l->unit;
+    return ~0u;
+}
@@ -5,9 +5,11 @@
 #include <unistd.h>
 #include <pthread.h>
 
+#include "bcache.h"
 #include "block.h"
 #include "common.h"
 #include "fs.h"
+#include "iotrace.h"
 #include "log.h"
 #include "tcp_utils.h"
 
@@ -359,13 +361,24 @@ int handle_pwd(tcp_buffer *wb, char *args, int len) {
     return 0;
 }
 
+int handle_io(tcp_buffer *wb, char *args, int len) {
+    // io [reset]
+    static __thread char buf[2048];
+    int reset = len >= 5 && strncmp(args, "reset", 5) == 0;
+    Log("Block I/O by caller%s", reset ? ", reset" : "");
+    iotrace_format(buf, sizeof(buf));
+    if (reset) iotrace_reset();
+    reply_with_yes(wb, buf, strlen(buf) + 1);
+    return 0;
+}
+
 static struct {
     const char *name;
     int (*handler)(tcp_buffer *wb, char *, int);
 } cmd_table[] = {{"f", handle_f},        {"mk", handle_mk},       {"mkdir", handle_mkdir}, {"rm", handle_rm},
                  {"cd", handle_cd},      {"rmdir", handle_rmdir}, {"ls", handle_ls},       {"cat", handle_cat},
                  {"w", handle_w},        {"i", handle_i},         {"d", handle_d},         {"e", handle_e},
-                 {"login", handle_login},{"pwd", handle_pwd}};
+                 {"login", handle_login},{"pwd", handle_pwd},     {"io", handle_io}};
 
 #define NCMD (sizeof(cmd_table) / sizeof(cmd_table[0]))
 
@@ -413,14 +426,39 @@ void cleanup(int id) {
         }
         break;
     }  
+    bcache_report();
+    csum_report();
+    iotrace_report();
 }
 
 FILE *log_file;
 
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
+    int policy = BC_LRU, nblocks = BCACHE_SIZE, scrub_ms = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (bcache_parse(optarg, &policy, &nblocks) < 0) {
+                fprintf(stderr, "Unknown buffer cache '%s', use lru|fifo|clock[:blocks] or off\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            scrub_ms = atoi(optarg);
+            if (scrub_ms <= 0) {
+                fprintf(stderr, "Invalid scrub interval '%s', use milliseconds\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            argc = 0;  // print usage
+        }
+    }
+    if (argc - optind < 2) {
         fprintf(stderr,
-                "Usage: %s <BDSPort> <FSPort>\n",
+                "Usage: %s [-c lru|fifo|clock[:blocks]|off] [-s scrub ms] "
+                "<BDSPort | raid0[:unit]:port,... | raid1:port,... | raid10[:unit]:port,... | file:image[:ncyl:nsec]> <FSPort>\n",
                 argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -430,8 +468,12 @@ int main(int argc, char *argv[]) {
     assert(BSIZE % sizeof(dinode) == 0);
     assert(BSIZE % sizeof(dirent) == 0);
 
-    diskseverinit(atoi(argv[1]));
-    Log("Connected to disk server");
+    bcache_init(policy, nblocks, NULL);
+    if (diskarrayinit(argv[optind]) < 0) {
+        fprintf(stderr, "Cannot reach disk '%s'\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    Log("Connected to disk %s", argv[optind]);
 
     // get disk info and store in global variables
     get_disk_info(&ncyl, &nsec);
@@ -439,13 +481,14 @@ int main(int argc, char *argv[]) {
 
     // read the superblock
     sbinit();
+    scrub_start(scrub_ms);
     Log("Superblock initialized, %sformatted", sb.magic == MAGIC ? "" : "not ");
     Log("size=%u, nblocks=%u, ninodes=%u", sb.size, sb.nblocks, sb.ninodes);
 
     pthread_mutex_init(&mutex_lock, NULL);
     for(int i = 0; i < MAXUSER; ++i) clientmap[i].client_id = -1;
     // command
-    tcp_server server = server_init(atoi(argv[2]), 12, on_connection, on_recv, cleanup);
+    tcp_server server = server_init(atoi(argv[optind + 1]), 12, on_connection, on_recv, cleanup);
     server_run(server);
 
     // never reached
@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "block.h"
 #include "log.h"
 #include "mintest.h"
 
+// attached in process unless a disk server spec is given
+#define TEST_IMAGE "test_fs.img"
+
 int mt_tests_run = 0;
 int mt_pass_count = 0;
 int mt_fail_count = 0;
@@ -11,8 +15,12 @@ int mt_fail_count = 0;
 void block_tests();
 void inode_tests();
 void fs_tests();
+void raid_tests();
+void bcache_tests();
 
 void all_tests() {
+    mt_run_suite(raid_tests);
+    mt_run_suite(bcache_tests);
     mt_run_suite(block_tests);
     mt_run_suite(inode_tests);
     mt_run_suite(fs_tests);
@@ -20,8 +28,16 @@ void all_tests() {
 
 FILE *log_file;
 
+// test_fs [block|inode|fs|raid|bcache|all [disk]], disk as for FS
 int main(int argc, char **argv) {
     log_init("fs.log");
+    const char *disk = argc > 2 ? argv[2] : "file:" TEST_IMAGE;
+    if (diskarrayinit(disk) < 0) {
+        fprintf(stderr, "Cannot reach disk '%s'\n", disk);
+        return 1;
+    }
+    int ncyl, nsec;
+    get_disk_info(&ncyl, &nsec);
     void (*test)() = all_tests;
     if (argc > 1) {
         if (strcmp(argv[1], "block") == 0) {
@@ -30,9 +46,15 @@ int main(int argc, char **argv) {
             test = inode_tests;
         } else if (strcmp(argv[1], "fs") == 0) {
             test = fs_tests;
+        } else if (strcmp(argv[1], "raid") == 0) {
+            test = raid_tests;
+        } else if (strcmp(argv[1], "bcache") == 0) {
+            test = bcache_tests;
         }
     }
     mt_main(test);
+    diskarrayclose();
+    if (argc <= 2) remove(TEST_IMAGE);
     log_close();
     return mt_fail_count;
 }
\ No newline at end of file
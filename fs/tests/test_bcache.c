@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "bcache.h"
+#include "mintest.h"
+
+// blocks written back, in order, instead of going to a disk server
+static uint written[64];
+static int nwritten, nbatch;
+
+static void fake_writeback(block_req *reqs, int n) {
+    nbatch++;
+    for (int i = 0; i < n; ++i) {
+        for (uint j = 0; j < reqs[i].n && nwritten < 64; ++j) written[nwritten++] = reqs[i].blockno + j;
+        reqs[i].status = BDS_OK;
+    }
+}
+
+static void fresh(int policy, int nblocks) {
+    bcache_init(policy, nblocks, fake_writeback);
+    nwritten = nbatch = 0;
+}
+
+// fill block b with its own number, so a read shows which block it got
+static void put(uint b, int dirty) {
+    uchar buf[BSIZE];
+    memset(buf, (uchar)b, BSIZE);
+    bcache_put(b, buf, dirty);
+}
+
+static int cached(uint b) {
+    uchar buf[BSIZE];
+    return bcache_get(b, buf) == 0 && buf[0] == (uchar)b && buf[BSIZE - 1] == (uchar)b;
+}
+
+mt_test(test_bcache_parse) {
+    int policy = -1, nblocks = 7;
+    mt_assert(bcache_parse("lru", &policy, &nblocks) == 0 && policy == BC_LRU && nblocks == 7);
+    mt_assert(bcache_parse("clock:256", &policy, &nblocks) == 0 && policy == BC_CLOCK && nblocks == 256);
+    mt_assert(bcache_parse("fifo:64", &policy, &nblocks) == 0 && policy == BC_FIFO && nblocks == 64);
+    mt_assert(bcache_parse("off", &policy, &nblocks) == 0 && nblocks == 0);
+    mt_assert(bcache_parse("arc", &policy, &nblocks) == -1);
+    mt_assert(bcache_parse("lru:0", &policy, &nblocks) == -1);
+    mt_assert(bcache_parse("lru:", &policy, &nblocks) == -1);
+    return 0;
+}
+
+mt_test(test_bcache_lru) {
+    fresh(BC_LRU, 3);
+    put(1, 0);
+    put(2, 0);
+    put(3, 0);
+    mt_assert(cached(1));  // 2 is now the least recently used
+    put(4, 0);
+    mt_assert(!cached(2));
+    mt_assert(cached(1) && cached(3) && cached(4));
+    bcache_counters c;
+    bcache_stats(&c);
+    mt_assert(c.hits == 4 && c.misses == 1 && c.evictions == 1 && c.writebacks == 0);
+    return 0;
+}
+
+mt_test(test_bcache_fifo) {
+    fresh(BC_FIFO, 3);
+    put(1, 0);
+    put(2, 0);
+    put(3, 0);
+    mt_assert(cached(1));  // a hit does not save it
+    put(4, 0);
+    mt_assert(!cached(1));
+    mt_assert(cached(2) && cached(3) && cached(4));
+    return 0;
+}
+
+mt_test(test_bcache_clock) {
+    fresh(BC_CLOCK, 3);
+    put(1, 0);
+    put(2, 0);
+    put(3, 0);
+    mt_assert(cached(1) && cached(3));  // second chance for 1 and 3
+    put(4, 0);
+    mt_assert(!cached(2));
+    // the hand went past 1 and cleared its bit, so it goes next
+    put(5, 0);
+    mt_assert(!cached(1));
+    mt_assert(cached(3) && cached(4) && cached(5));
+    return 0;
+}
+
+mt_test(test_bcache_writeback) {
+    fresh(BC_LRU, 4);
+    put(10, 1);
+    put(11, 1);
+    put(11, 1);  // rewriting a dirty block is still one write
+    put(20, 0);
+    put(12, 1);
+    mt_assert(nwritten == 0);  // nothing leaves before a sync or an eviction
+
+    // evicting the dirty 10 writes it on its own
+    put(30, 0);
+    mt_assert(nwritten == 1 && written[0] == 10);
+
+    // the rest goes out in one batch, adjacent blocks as one request
+    bcache_sync();
+    mt_assert(nwritten == 3 && written[1] == 11 && written[2] == 12 && nbatch == 2);
+    bcache_sync();
+    mt_assert(nwritten == 3);  // all clean now
+    mt_assert(cached(11) && cached(12));
+    return 0;
+}
+
+mt_test(test_bcache_invalidate) {
+    fresh(BC_LRU, 8);
+    for (uint b = 40; b < 46; ++b) put(b, 1);
+    bcache_invalidate(42, 2);
+    mt_assert(cached(41) && !cached(42) && !cached(43) && cached(44));
+    bcache_invalidate(0, 1000);  // more than the cache holds, scans it instead
+    mt_assert(!cached(40) && !cached(45));
+    bcache_sync();
+    mt_assert(nwritten == 0);  // dropped dirty blocks are never written
+
+    // with the cache off every write goes straight through
+    fresh(BC_LRU, 0);
+    put(7, 1);
+    mt_assert(nwritten == 1 && written[0] == 7 && !cached(7));
+    bcache_init(BC_LRU, BCACHE_SIZE, NULL);
+    return 0;
+}
+
+void bcache_tests() {
+    mt_run_test(test_bcache_parse);
+    mt_run_test(test_bcache_lru);
+    mt_run_test(test_bcache_fifo);
+    mt_run_test(test_bcache_clock);
+    mt_run_test(test_bcache_writeback);
+    mt_run_test(test_bcache_invalidate);
+}
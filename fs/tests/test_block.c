@@ -1,13 +1,19 @@
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "block.h"
 #include "common.h"
+#include "crc32c.h"
+#include "disk.h"
+#include "fs.h"
 #include "mintest.h"
 
 int nmeta;
 
 void mock_format() {
-    sb.size = 2048;  // 2048 blocks
+    sb.size = 2048;  // 2048 blocks, one cylinder group
+    sb.cgsize = sb.ipg = sb.csumstart = 0;
     int nbitmap = (sb.size / BPB) + 1;
     nmeta = nbitmap + 7;  // some first blocks for metadata
 
@@ -39,6 +45,27 @@ mt_test(test_read_write_block) {
     return 0;
 }
 
+mt_test(test_read_write_blocks) {
+    // more blocks than one ranged request carries
+    int n = 100;
+    uchar *write_buf = malloc(n * BSIZE), *read_buf = malloc(n * BSIZE);
+    for (int i = 0; i < n * BSIZE; i++) {
+        write_buf[i] = (uchar)(i * 7 + i / BSIZE);
+    }
+
+    write_blocks(60, n, write_buf);
+    read_blocks(60, n, read_buf);
+    mt_assert(memcmp(write_buf, read_buf, n * BSIZE) == 0);
+
+    // single block access agrees
+    read_block(60 + 77, read_buf);
+    mt_assert(memcmp(write_buf + 77 * BSIZE, read_buf, BSIZE) == 0);
+
+    free(write_buf);
+    free(read_buf);
+    return 0;
+}
+
 mt_test(test_zero_block) {
     uchar buf[BSIZE];
     memset(buf, 0xFF, BSIZE);
@@ -100,10 +127,187 @@ mt_test(test_free_block) {
     return 0;
 }
 
+mt_test(test_free_block_discard) {
+    mock_format();
+    sb.freezero = FREEZERO;
+    uchar buf[BSIZE], zero[BSIZE] = {0};
+    memset(buf, 0xAB, BSIZE);
+
+    // reallocated before its discard went out, so it is zeroed instead,
+    // formatting again brings the allocator back to it
+    uint bno = allocate_block();
+    write_block(bno, buf);
+    free_block(bno);
+    mock_format();
+    mt_assert(allocate_block() == bno);
+    read_block(bno, buf);
+    mt_assert(memcmp(buf, zero, BSIZE) == 0);
+
+    // discarded, it reads as zeros and comes back without a write
+    memset(buf, 0xAB, BSIZE);
+    write_block(bno, buf);
+    free_block(bno);
+    flush_discards();
+    read_block(bno, buf);
+    mt_assert(memcmp(buf, zero, BSIZE) == 0);
+    mock_format();
+    mt_assert(allocate_block() == bno);
+    sb.freezero = 0;
+    return 0;
+}
+
+mt_test(test_allocate_next_fit) {
+    mock_format();
+    uint a = allocate_block(), b = allocate_block();
+    mt_assert(b == a + 1);
+    // a freed block is not handed out again until the search wraps around
+    free_block(a);
+    mt_assert(allocate_block() == b + 1);
+    for (uint i = b + 2; i < sb.size; i++) mt_assert(allocate_block() == i);
+    mt_assert(allocate_block() == a);
+    mt_assert(allocate_block() == 0);  // full
+
+    // the bitmap reaches the disk on flush_disk(), read it past the caches
+    uchar buf[BSIZE];
+    flush_disk();
+    block_req r = {BDS_OP_READ, BBLOCK(a), 1, buf};
+    disk_batch(&r, 1);
+    mt_assert(r.status == BDS_OK && (buf[a / 8] & (1 << (a % 8))) != 0);
+    return 0;
+}
+
+static int ndone;
+
+static void count_done(bio *b, void *arg) {
+    ndone++;
+    *(int *)arg = b->req.status;
+}
+
+mt_test(test_bio) {
+    const int n = 8;
+    uchar *data = malloc(n * BSIZE), *back = calloc(n, BSIZE);
+    for (int i = 0; i < n * BSIZE; i++) data[i] = (uchar)(i * 7 + i / BSIZE);
+
+    // blocks apart, so each write is a request of its own, all in flight together
+    bio *bios[8];
+    int status[8];
+    ndone = 0;
+    for (int i = 0; i < n; i++) bios[i] = bio_submit(BDS_OP_WRITE, 1000 + 3 * i, 1, data + i * BSIZE, count_done, &status[i]);
+    mt_assert(bio_wait_all(bios, n) == BDS_OK && ndone == n);
+    for (int i = 0; i < n; i++) mt_assert(status[i] == BDS_OK);
+
+    for (int i = 0; i < n; i++) bios[i] = bio_submit(BDS_OP_READ, 1000 + 3 * i, 1, back + i * BSIZE, NULL, NULL);
+    while (!bio_poll(bios[n - 1]));
+    mt_assert(bio_wait_all(bios, n) == BDS_OK);
+    mt_assert(memcmp(data, back, n * BSIZE) == 0);
+
+    // a read sees a write still in the buffer cache
+    write_block(1000, data + BSIZE);
+    mt_assert(bio_wait(bio_submit(BDS_OP_READ, 1000, 1, back, NULL, NULL)) == BDS_OK);
+    mt_assert(memcmp(back, data + BSIZE, BSIZE) == 0);
+    free(data);
+    free(back);
+    return 0;
+}
+
+// write blocks of its own past the caches and read them back, 0 if they match
+static void *io_thread(void *arg) {
+    uint first = 1200 + (long)arg * 32;
+    uchar buf[8 * BSIZE], back[8 * BSIZE];
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < sizeof(buf); i++) buf[i] = (uchar)(i + round + (long)arg);
+        block_req w[2] = {{BDS_OP_WRITE, first, 4, buf}, {BDS_OP_WRITE, first + 16, 4, buf + 4 * BSIZE}};
+        disk_batch(w, 2);
+        block_req r[2] = {{BDS_OP_READ, first, 4, back}, {BDS_OP_READ, first + 16, 4, back + 4 * BSIZE}};
+        disk_batch(r, 2);
+        if (w[0].status || w[1].status || r[0].status || r[1].status || memcmp(buf, back, sizeof(buf)))
+            return (void *)1;
+    }
+    return NULL;
+}
+
+mt_test(test_threads) {
+    // each thread has connections of its own, all in use at once
+    pthread_t t[4];
+    for (long i = 0; i < 4; i++) pthread_create(&t[i], NULL, io_thread, (void *)i);
+    void *ret;
+    int failed = 0;
+    for (int i = 0; i < 4; i++) {
+        pthread_join(t[i], &ret);
+        failed += ret != NULL;
+    }
+    mt_assert(failed == 0);
+    // and a thread started later reuses what those left behind
+    pthread_create(&t[0], NULL, io_thread, (void *)0);
+    pthread_join(t[0], &ret);
+    mt_assert(ret == NULL);
+    return 0;
+}
+
+mt_test(test_crc32c) {
+    mt_assert(crc32c(0, "123456789", 9) == 0xE3069283 && crc32c_sw(0, "123456789", 9) == 0xE3069283);
+    uchar buf[BSIZE + 8];
+    memset(buf, 0, 32);
+    mt_assert(crc32c(0, buf, 32) == 0x8A9136AA);
+    // the instruction and the tables agree at any length and alignment
+    for (int i = 0; i < sizeof(buf); i++) buf[i] = (uchar)(i * 31 + 7);
+    for (int off = 0; off < 8; off++)
+        for (int n = 0; n + off <= sizeof(buf); n += 37) mt_assert(crc32c(0, buf + off, n) == crc32c_sw(0, buf + off, n));
+    mt_assert(crc32c(crc32c(0, buf, 100), buf + 100, BSIZE - 100) == crc32c(0, buf, BSIZE));
+    return 0;
+}
+
+mt_test(test_checksums) {
+    cmd_login(1);
+    mt_assert(cmd_f(1024, 63) == E_SUCCESS && sb.csumstart > 0);
+    uint b = 3 * sb.cgsize + sb.datastart;  // unused data blocks
+    uchar data[4 * BSIZE];
+    for (int i = 0; i < sizeof(data); i++) data[i] = (uchar)(i * 3 + i / BSIZE);
+    write_blocks(b, 4, data);
+    flush_disk();
+    // the group's metadata, what was written and the free blocks after it
+    mt_assert(scrub(3 * sb.cgsize, sb.cgsize) == 0);
+
+    // the same once the table is loaded back from the disk
+    uint start = sb.csumstart;
+    sb.csumstart = 0;
+    mt_assert(scrub(b, 4) == 0);  // drops it
+    sb.csumstart = start;
+    mt_assert(scrub(3 * sb.cgsize, sb.cgsize) == 0);
+
+    // a block changed behind the file system's back, only possible with the
+    // image attached in process
+    uchar junk[BSIZE];
+    memset(junk, 0x5a, BSIZE);
+    if (disk_cmd_wv((b + 1) / 63, (b + 1) % 63, 1, (char *)junk) == 0) {
+        mt_assert(scrub(b, 4) == 1);
+        write_blocks(b + 1, 1, data + BSIZE);  // rewriting it repairs it
+        mt_assert(scrub(b, 4) == 0);
+    }
+
+    // the scrubber reads beside the file system's own reads and writes
+    scrub_start(1);
+    for (int k = 0; k < 50; k++) {
+        uchar back[sizeof(data)];
+        write_blocks(b, 4, data);
+        read_blocks(b, 4, back);
+        mt_assert(memcmp(back, data, sizeof(data)) == 0);
+    }
+    scrub_stop();
+    return 0;
+}
+
 void block_tests() {
     mt_run_test(test_read_write_block);
+    mt_run_test(test_read_write_blocks);
     mt_run_test(test_zero_block);
     mt_run_test(test_allocate_block);
     mt_run_test(test_allocate_block_all);
     mt_run_test(test_free_block);
+    mt_run_test(test_free_block_discard);
+    mt_run_test(test_allocate_next_fit);
+    mt_run_test(test_bio);
+    mt_run_test(test_threads);
+    mt_run_test(test_crc32c);
+    mt_run_test(test_checksums);
 }
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "bcache.h"
 #include "block.h"
 #include "common.h"
 #include "fs.h"
@@ -165,6 +166,49 @@ mt_test(test_small_file_ops) {
     return 0;
 }
 
+// long enough to be read in several chunks, with shifts across them
+mt_test(test_large_file_ops) {
+    format();
+    cmd_mk("large.txt", 0b1111);
+    const uint size = 40 * BSIZE + 100;
+    char *data = malloc(size + 1), *want = malloc(size + 6);
+    for (uint i = 0; i < size; i++) data[i] = 'a' + i % 23;
+    data[size] = 0;
+    // a write or an insert takes at most a block
+    mt_assert(cmd_w("large.txt", BSIZE, data) == E_SUCCESS);
+    for (uint off = BSIZE; off < size; off += BSIZE)
+        mt_assert(cmd_i("large.txt", off, min(BSIZE, size - off), data + off) == E_SUCCESS);
+    // from the disk, against disk servers the chunks after the first are read ahead
+    flush_disk();
+    bcache_init(BC_LRU, BCACHE_SIZE, NULL);
+    uchar *buf = NULL;
+    uint len;
+    mt_assert(cmd_cat("large.txt", &buf, &len) == E_SUCCESS);
+    mt_assert(len == size + 1 && memcmp(buf, data, size) == 0);
+    free(buf);
+
+    uint pos = 16 * BSIZE - 2;
+    mt_assert(cmd_i("large.txt", pos, 5, "12345") == E_SUCCESS);
+    memcpy(want, data, pos);
+    memcpy(want + pos, "12345", 5);
+    memcpy(want + pos + 5, data + pos, size - pos);
+    buf = NULL;
+    mt_assert(cmd_cat("large.txt", &buf, &len) == E_SUCCESS);
+    mt_assert(len == size + 6 && memcmp(buf, want, size + 5) == 0);
+    free(buf);
+
+    mt_assert(cmd_d("large.txt", 3, 5 * BSIZE) == E_SUCCESS);
+    memmove(want + 3, want + 3 + 5 * BSIZE, size + 5 - 3 - 5 * BSIZE);
+    buf = NULL;
+    mt_assert(cmd_cat("large.txt", &buf, &len) == E_SUCCESS);
+    mt_assert(len == size + 6 - 5 * BSIZE && memcmp(buf, want, size + 5 - 5 * BSIZE) == 0);
+    free(buf);
+    free(data);
+    free(want);
+    mt_assert(cmd_rm("large.txt") == E_SUCCESS);
+    return 0;
+}
+
 static void generate_random_name(char *name, int length) {
     const char charset[] = "abcdefghijklmnopqrstuvwxyz";
     for (int i = 0; i < length; i++) {
@@ -255,6 +299,7 @@ void fs_tests() {
     mt_run_test(test_cmd_rmdir_with_files);
     mt_run_test(test_file_lifecycle);
     mt_run_test(test_small_file_ops);
+    mt_run_test(test_large_file_ops);
     mt_run_test(test_folder_tree_operations);
     mt_run_test(test_folder_tree_with_rm);
 }
@@ -1,9 +1,11 @@
 #include <string.h>
 #include "inode.h"
+#include "bcache.h"
 #include "block.h"
 #include "common.h"
 #include "mintest.h"
 #include "fs.h"
+#include "iotrace.h"
 #include <time.h>
 #include <stdlib.h>
 
@@ -87,6 +89,13 @@ mt_test(test_writei) {
     return 0;
 }
 
+// free blocks of the whole disk
+static uint free_blocks() {
+    uint n = 0;
+    for (uint g = 0; g < cg_count(); ++g) n += cg_free(g);
+    return n;
+}
+
 mt_test(test_readi) {
     format();
     inode *ip = ialloc(T_FILE);
@@ -107,6 +116,20 @@ mt_test(test_readi) {
     bytes_read = readi(ip, extra_buf, sizeof(data), sizeof(extra_buf));
     mt_assert(bytes_read == 0);  // No data should be read beyond EOF
 
+    // blocks the file has no disk block for read as zeros, and stay without
+    uint inum = ip->inum;
+    iput(ip);
+    flush_disk();
+    ip = iget(inum);
+    ip->size = 3 * BSIZE;
+    uint nfree = free_blocks();
+    uchar hole[2 * BSIZE], zero[2 * BSIZE] = {0};
+    memset(hole, 0xff, sizeof(hole));
+    mt_assert(readi(ip, hole, BSIZE, sizeof(hole)) == sizeof(hole));
+    mt_assert(memcmp(hole, zero, sizeof(zero)) == 0);
+    mt_assert(free_blocks() == nfree && ip->addrs[1] == 0 && ip->addrs[2] == 0);
+    ip->size = sizeof(data);
+
     iput(ip);
     return 0;
 }
@@ -194,6 +217,488 @@ mt_test(test_random_binary_read_write) {
     return 0;
 }
 
+mt_test(test_delayed_allocation) {
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    uint inum = ip->inum;
+
+    // past the direct blocks, so an indirect block is needed as well
+    const uint nblocks = NDIRECT + 11;
+    uchar *data = malloc(nblocks * BSIZE), *buf = malloc(nblocks * BSIZE);
+    for (uint i = 0; i < nblocks * BSIZE; i++) data[i] = (uchar)(i * 31 + i / BSIZE);
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+
+    // no disk blocks until the flush, but the data reads back already
+    mt_assert(ip->addrs[0] == 0 && ip->addrs[NDIRECT] == 0);
+    mt_assert(readi(ip, buf, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    mt_assert(memcmp(data, buf, nblocks * BSIZE) == 0);
+    iput(ip);
+
+    // then the whole file is one run
+    flush_disk();
+    ip = iget(inum);
+    for (uint i = 0; i < nblocks; i++) mt_assert(imapblock(ip, i) == ip->addrs[0] + i);
+    memset(buf, 0, nblocks * BSIZE);
+    mt_assert(readi(ip, buf, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    mt_assert(memcmp(data, buf, nblocks * BSIZE) == 0);
+
+    // overwriting in place and appending mix held and allocated blocks
+    writei(ip, data, BSIZE / 2, BSIZE);
+    writei(ip, data, nblocks * BSIZE, BSIZE);
+    mt_assert(readi(ip, buf, BSIZE / 2, BSIZE) == BSIZE && memcmp(data, buf, BSIZE) == 0);
+    mt_assert(readi(ip, buf, nblocks * BSIZE, BSIZE) == BSIZE && memcmp(data, buf, BSIZE) == 0);
+
+    free(data);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+// the pool of held blocks is shared, the file that fills it up makes room
+// for all of them, not just for its own
+mt_test(test_delayed_bound) {
+    format();
+    inode *a = ialloc(T_FILE), *b = ialloc(T_FILE);
+    mt_assert(a != NULL && b != NULL);
+    const uint na = NDELAYED - 8, nb = 16;
+    uchar *data = malloc(na * BSIZE), *buf = malloc(na * BSIZE);
+    for (uint i = 0; i < na * BSIZE; i++) data[i] = (uchar)(i * 7 + i / BSIZE);
+    uint nfree = free_blocks();
+    mt_assert(writei(a, data, 0, na * BSIZE) == na * BSIZE);
+    mt_assert(a->addrs[0] == 0 && free_blocks() == nfree);
+    mt_assert(writei(b, data, 0, nb * BSIZE) == nb * BSIZE);
+
+    // a's blocks went out when b hit the bound, along with b's first ones
+    mt_assert(a->addrs[0] != 0 && b->addrs[0] != 0);
+    mt_assert(nfree - free_blocks() >= na + 8);
+    mt_assert(readi(a, buf, 0, na * BSIZE) == na * BSIZE && memcmp(data, buf, na * BSIZE) == 0);
+    mt_assert(readi(b, buf, 0, nb * BSIZE) == nb * BSIZE && memcmp(data, buf, nb * BSIZE) == 0);
+
+    free(data);
+    free(buf);
+    iput(a);
+    iput(b);
+    flush_disk();
+    return 0;
+}
+
+mt_test(test_cylinder_groups) {
+    format();
+    mt_assert(sb.cgsize > 0 && cg_count() > 1);
+
+    // data goes to the group of its inode, next to it
+    inode *ip = ialloc_group(T_FILE, 3);
+    mt_assert(ip != NULL && IGROUP(ip->inum) == 3 && BGROUP(IBLOCK(ip->inum)) == 3);
+    uint inum = ip->inum;
+    uchar data[4 * BSIZE];
+    memset(data, 7, sizeof(data));
+    mt_assert(writei(ip, data, 0, sizeof(data)) == sizeof(data));
+    iput(ip);
+    flush_disk();
+    ip = iget(inum);
+    for (uint i = 0; i < 4; i++) mt_assert(BGROUP(imapblock(ip, i)) == 3);
+    iput(ip);
+
+    // a new directory leaves the root's group, which has less room
+    mt_assert(icreate(T_DIR, "d", 0, 1, 0b11111) == 0);
+    uint dnum = findinum("d");
+    mt_assert(dnum < sb.ninodes && IGROUP(dnum) != 0 && IGROUP(dnum) != 3);
+    // and a file in it stays in its group
+    mt_assert(icreate(T_FILE, "f", dnum, 1, 0b11111) == 0);
+    ip = iget(dnum);
+    dirent des[3];
+    mt_assert(readi(ip, (uchar *)des, 0, sizeof(des)) == sizeof(des));
+    mt_assert(strcmp(des[2].name, "f") == 0 && IGROUP(des[2].inum) == IGROUP(dnum));
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_readahead) {
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    const uint nblocks = 40;
+    uchar *data = malloc(nblocks * BSIZE), *buf = malloc(nblocks * BSIZE);
+    for (uint i = 0; i < nblocks * BSIZE; i++) data[i] = (uchar)(i * 13 + i / BSIZE);
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    uint inum = ip->inum;
+    iput(ip);
+    flush_disk();
+    bcache_init(BC_LRU, BCACHE_SIZE, NULL);  // start cold
+    ip = iget(inum);
+
+    // the first read from the start reads ahead a little, the next further
+    uchar tmp[BSIZE];
+    mt_assert(readi(ip, buf, 0, 2 * BSIZE) == 2 * BSIZE);
+    read_ahead_wait();
+    mt_assert(bcache_peek(imapblock(ip, 2), tmp) == 0 && bcache_peek(imapblock(ip, 5), tmp) == 0);
+    mt_assert(bcache_peek(imapblock(ip, 6), tmp) < 0);
+    mt_assert(readi(ip, buf + 2 * BSIZE, 2 * BSIZE, 2 * BSIZE) == 2 * BSIZE);
+    read_ahead_wait();
+    mt_assert(bcache_peek(imapblock(ip, 11), tmp) == 0 && bcache_peek(imapblock(ip, 12), tmp) < 0);
+
+    // the next read finds everything in the cache, and what the file holds
+    bcache_counters before, after;
+    bcache_stats(&before);
+    mt_assert(readi(ip, buf + 4 * BSIZE, 4 * BSIZE, 8 * BSIZE) == 8 * BSIZE);
+    bcache_stats(&after);
+    mt_assert(after.misses == before.misses);
+    mt_assert(memcmp(data, buf, 12 * BSIZE) == 0);
+
+    // a write sent while the read ahead is in flight wins
+    mt_assert(readi(ip, buf, 12 * BSIZE, BSIZE) == BSIZE);
+    memset(buf, 0xAB, BSIZE);
+    write_blocks(imapblock(ip, 30), 1, buf);
+    read_ahead_wait();
+    memset(buf, 0, BSIZE);
+    mt_assert(readi(ip, buf, 30 * BSIZE, BSIZE) == BSIZE && buf[0] == 0xAB && buf[BSIZE - 1] == 0xAB);
+
+    // writing dirty blocks back reaps the read ahead, which fills the cache:
+    // on a sync, and on evictions from a cache too small to hold them all
+    for (int small = 0; small < 2; small++) {
+        bcache_init(BC_LRU, small ? 8 : BCACHE_SIZE, NULL);
+        mt_assert(readi(ip, buf, 0, 2 * BSIZE) == 2 * BSIZE);
+        memset(buf, 0xC0 + small, BSIZE);
+        for (uint i = 20; i < 30; i++) write_block(imapblock(ip, i), buf);
+        flush_disk();
+        read_ahead_wait();
+        mt_assert(readi(ip, buf, 0, 30 * BSIZE) == 30 * BSIZE);
+        mt_assert(memcmp(data, buf, 20 * BSIZE) == 0);
+        mt_assert(buf[20 * BSIZE] == 0xC0 + small && buf[30 * BSIZE - 1] == 0xC0 + small);
+    }
+    bcache_init(BC_LRU, BCACHE_SIZE, NULL);
+
+    free(data);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+mt_test(test_overwrite) {
+    format();
+    inode *ip = ialloc_group(T_FILE, 1);
+    const uint nblocks = 64;
+    uchar *data = malloc(nblocks * BSIZE), *buf = malloc(nblocks * BSIZE);
+    memset(data, 1, nblocks * BSIZE);
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    flush_disk();
+    bcache_init(BC_LRU, BCACHE_SIZE, NULL);  // start cold
+
+    // only the two blocks written in part are read, the run goes out at once
+    for (uint i = 0; i < nblocks * BSIZE; i++) data[i] = (uchar)(i * 11 + i / BSIZE);
+    iotrace_reset();
+    mt_assert(writei(ip, data + 100, 100, (nblocks - 2) * BSIZE) == (nblocks - 2) * BSIZE);
+    iotrace_counters c;
+    iotrace_stats(IO_DATA, IO_READ, &c);
+    mt_assert(c.calls == 2 && c.blocks == 2);
+    iotrace_stats(IO_DATA, IO_WRITE, &c);
+    mt_assert(c.calls == 1 && c.blocks == nblocks - 1);
+
+    // and a short one goes through the buffer cache
+    mt_assert(writei(ip, data + 10, 10, 2 * BSIZE) == 2 * BSIZE);
+    mt_assert(bcache_peek(imapblock(ip, 1), buf) == 0 && memcmp(buf, data + BSIZE, BSIZE) == 0);
+    flush_disk();
+    memset(data, 1, 10);
+    memset(data + 100 + (nblocks - 2) * BSIZE, 1, 2 * BSIZE - 100);
+    mt_assert(readi(ip, buf, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    mt_assert(memcmp(data, buf, nblocks * BSIZE) == 0);
+
+    free(data);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+// blocks of the file, the two filled with a and b
+static int holds(inode *ip, uint nblocks, uchar a, uchar b) {
+    uchar buf[BSIZE];
+    for (uint i = 0; i < nblocks; i++)
+        if (readi(ip, buf, i * BSIZE, BSIZE) != BSIZE || buf[0] != (uchar)(a + i) || buf[BSIZE - 1] != (uchar)(b + i)) return 0;
+    return 1;
+}
+
+mt_test(test_extents) {
+    format();
+    flush_disk();
+
+    // a file written in one piece is one extent in the inode, mapping its
+    // blocks reads no other block
+    mt_assert(icreate(T_FILE, "a", 0, 1, 0b11111) == 0);
+    uint anum = findinum("a");
+    inode *ip = iget(anum);
+    mt_assert(ip->mode & M_EXTENT);
+    // a directory keeps direct blocks
+    mt_assert(icreate(T_DIR, "d", 0, 1, 0b11111) == 0);
+    inode *dp = iget(findinum("d"));
+    mt_assert(!(dp->mode & M_EXTENT));
+    iput(dp);
+    const uint nblocks = 200;
+    uchar *data = calloc(MAXFILEB + 1, BSIZE);
+    for (uint i = 0; i < nblocks; i++) {
+        memset(data + i * BSIZE, 1 + i, BSIZE / 2);
+        memset(data + i * BSIZE + BSIZE / 2, 2 + i, BSIZE / 2);
+    }
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    iput(ip);
+    flush_disk();
+    ip = iget(anum);
+    iotrace_reset();
+    uint first = imapblock(ip, 0);
+    for (uint i = 0; i < nblocks; i += 37) mt_assert(imapblock(ip, i) == first + i);
+    iotrace_counters c;
+    iotrace_stats(IO_INDIRECT, IO_READ, &c);
+    mt_assert(c.calls == 0);
+    itrunc(ip);
+    iput(ip);
+    flush_disk();
+
+    // two files written a block at a time in turn have an extent per block,
+    // more than a block of the tree holds
+    uint before = free_blocks();
+    mt_assert(icreate(T_FILE, "b", 0, 1, 0b11111) == 0);
+    uint bnum = findinum("b");
+    inode *a = iget(anum), *b = iget(bnum);
+    for (uint i = 0; i < nblocks; i++) {
+        mt_assert(writei(a, data + i * BSIZE, i * BSIZE, BSIZE) == BSIZE);
+        memset(data + nblocks * BSIZE, 100 + i, BSIZE);
+        mt_assert(writei(b, data + nblocks * BSIZE, i * BSIZE, BSIZE) == BSIZE);
+        flush_disk();
+    }
+    mt_assert(imapblock(a, 1) != imapblock(a, 0) + 1);
+    iput(a);
+    iput(b);
+    idrop_cache();  // read from the disk again
+    a = iget(anum);
+    b = iget(bnum);
+    mt_assert(holds(a, nblocks, 1, 2) && holds(b, nblocks, 100, 100));
+
+    // shrinking one frees the blocks past its end
+    uint used = before - free_blocks();
+    mt_assert(used > 2 * nblocks);
+    a->size = 10 * BSIZE;
+    itest(a);
+    mt_assert(before - free_blocks() < used - (nblocks - 10));
+    mt_assert(holds(a, 10, 1, 2) && holds(b, nblocks, 100, 100));
+    mt_assert(writei(a, data + 10 * BSIZE, 10 * BSIZE, BSIZE) == BSIZE);
+    flush_disk();
+    mt_assert(holds(a, 11, 1, 2));
+    itrunc(a);
+    itrunc(b);
+    iput(a);
+    iput(b);
+    flush_disk();
+    mt_assert(free_blocks() == before);
+
+    // past what indirect blocks map, only a file with extents grows
+    ip = ialloc(T_FILE);
+    mt_assert(writei(ip, data, 0, (MAXFILEB + 1) * BSIZE) == -1);
+    iput(ip);
+    ip = iget(anum);
+    mt_assert(writei(ip, data, 0, (MAXFILEB + 1) * BSIZE) == (MAXFILEB + 1) * BSIZE);
+    iput(ip);
+    flush_disk();
+    ip = iget(anum);
+    memset(data, 0, BSIZE);
+    mt_assert(readi(ip, data, MAXFILEB * BSIZE, BSIZE) == BSIZE && imapblock(ip, MAXFILEB) != 0);
+    itrunc(ip);
+    iput(ip);
+    flush_disk();
+    free(data);
+    return 0;
+}
+
+// shrinking a file on direct and indirect blocks frees and unmaps every
+// block past its end, and a write there later takes a new one
+mt_test(test_itest_direct) {
+    format();
+    flush_disk();
+    uint before = free_blocks();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(!(ip->mode & M_EXTENT));
+    const uint nblocks = NDIRECT + 11;
+    uchar *data = malloc(nblocks * BSIZE), *buf = malloc(BSIZE);
+    for (uint i = 0; i < nblocks * BSIZE; i++) data[i] = (uchar)(i * 13 + i / BSIZE);
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    flush_disk();
+    uint used = before - free_blocks();
+
+    ip->size = 4 * BSIZE;
+    itest(ip);
+    mt_assert(ip->blocks == 4 && before - free_blocks() == used - (nblocks - 4));
+    mt_assert(writei(ip, data, 4 * BSIZE, BSIZE) == BSIZE);
+    flush_disk();
+    mt_assert(before - free_blocks() == used - (nblocks - 5));
+    mt_assert(readi(ip, buf, 4 * BSIZE, BSIZE) == BSIZE && memcmp(buf, data, BSIZE) == 0);
+    itrunc(ip);
+    iput(ip);
+    flush_disk();
+    mt_assert(free_blocks() == before);
+    free(data);
+    free(buf);
+    return 0;
+}
+
+mt_test(test_l2p) {
+    format();
+    // one block past the first block of the double indirect block
+    inode *ip = ialloc(T_FILE);
+    const uint nblocks = NDIRECT + 2 * APB + 1;
+    uchar *data = malloc(nblocks * BSIZE), *buf = malloc(nblocks * BSIZE);
+    for (uint i = 0; i < nblocks * BSIZE; i++) data[i] = (uchar)(i * 7 + i / BSIZE);
+    mt_assert(writei(ip, data, 0, nblocks * BSIZE) == nblocks * BSIZE);
+    uint inum = ip->inum;
+    iput(ip);
+    flush_disk();
+
+    // a sequential pass reads the single indirect block once, and the
+    // double one once for each block it leads to
+    idrop_cache();
+    ip = iget(inum);
+    iotrace_reset();
+    for (uint off = 0; off < nblocks * BSIZE; off += 3 * BSIZE)
+        mt_assert(readi(ip, buf + off, off, 3 * BSIZE) == min(3 * BSIZE, nblocks * BSIZE - off));
+    mt_assert(memcmp(data, buf, nblocks * BSIZE) == 0);
+    iotrace_counters c;
+    iotrace_stats(IO_INDIRECT, IO_READ, &c);
+    mt_assert(c.calls == 1 + 2 * 2);
+
+    // the blocks a truncation frees are not mapped from memory after it
+    uint old = imapblock(ip, 0);
+    itrunc(ip);
+    mt_assert(writei(ip, data + BSIZE, 0, 2 * BSIZE) == 2 * BSIZE);
+    flush_disk();
+    mt_assert(ip->addrs[0] != old && imapblock(ip, 0) == ip->addrs[0] && imapblock(ip, 1) == ip->addrs[1]);
+    mt_assert(readi(ip, buf, 0, 2 * BSIZE) == 2 * BSIZE && memcmp(data + BSIZE, buf, 2 * BSIZE) == 0);
+
+    free(data);
+    free(buf);
+    iput(ip);
+    return 0;
+}
+
+// inode block reads since iotrace_reset()
+static long inode_reads() {
+    iotrace_counters c;
+    iotrace_stats(IO_INODE, IO_READ, &c);
+    return c.calls;
+}
+
+mt_test(test_icache) {
+    format();
+    inode *ip = ialloc(T_FILE);
+    mt_assert(ip != NULL);
+    uint inum = ip->inum;
+    iput(ip);
+    flush_disk();  // a changed inode is held until then
+
+    // every iget() of an inode in memory shares it, without a read
+    iotrace_reset();
+    inode *a = iget(inum), *b = iget(inum);
+    mt_assert(a != NULL && a == b && a->ref == 2 && inode_reads() == 0);
+    a->size = 100;
+    iupdate(a);
+    mt_assert(b->size == 100);
+    iput(a);
+    iput(b);
+    ip = iget(inum);
+    mt_assert(ip->size == 100 && inode_reads() == 0);
+    iput(ip);
+
+    // past NICACHE unused inodes the least recently put is read again
+    inode *more[NICACHE];
+    for (int i = 0; i < NICACHE; ++i) more[i] = ialloc(T_FILE);
+    for (int i = 0; i < NICACHE; ++i) iput(more[i]);
+    flush_disk();
+    iotrace_reset();
+    ip = iget(inum);
+    mt_assert(ip != NULL && ip->size == 100 && inode_reads() == 1);
+    iput(ip);
+
+    // a format forgets them all
+    format();
+    mt_assert(iget(inum) == NULL);
+    return 0;
+}
+
+mt_test(test_iflush) {
+    format();
+    flush_disk();
+    iotrace_counters c;
+
+    // the inodes of one block, each changed more than once, are written together
+    iotrace_reset();
+    inode *ip[IPB];
+    for (int i = 0; i < IPB; ++i) {
+        ip[i] = ialloc_group(T_FILE, 1);
+        mt_assert(ip[i] != NULL && IBLOCK(ip[i]->inum) == IBLOCK(ip[0]->inum));
+        ip[i]->size = i;
+        iupdate(ip[i]);
+        ip[i]->blocks = 2 * i;
+        iupdate(ip[i]);
+    }
+    iotrace_stats(IO_INODE, IO_WRITE, &c);
+    mt_assert(c.calls == 0);
+    flush_disk();
+    iotrace_stats(IO_INODE, IO_WRITE, &c);
+    mt_assert(c.calls == 1);
+
+    // and reach the disk
+    uint inum[IPB];
+    for (int i = 0; i < IPB; ++i) {
+        inum[i] = ip[i]->inum;
+        iput(ip[i]);
+    }
+    idrop_cache();
+    for (int i = 0; i < IPB; ++i) {
+        inode *back = iget(inum[i]);
+        mt_assert(back != NULL && back->type == T_FILE && back->size == i && back->blocks == 2 * i);
+        iput(back);
+    }
+    return 0;
+}
+
+mt_test(test_iotrace) {
+    format();
+    flush_disk();
+    iotrace_reset();
+
+    // a file one block past the direct ones, and its entry in the root, then
+    // the same through indirect blocks
+    mt_assert(icreate(T_FILE, "f", 0, 1, 0b11111) == 0);
+    inode *ip = iget(findinum("f"));
+    uchar data[(NDIRECT + 1) * BSIZE];
+    memset(data, 3, sizeof(data));
+    mt_assert(writei(ip, data, 0, sizeof(data)) == sizeof(data));
+    iput(ip);
+    ip = ialloc(T_FILE);
+    mt_assert(writei(ip, data, 0, sizeof(data)) == sizeof(data));
+    iput(ip);
+    flush_disk();
+    uchar buf[BSIZE];
+    read_block(0, buf);
+
+    iotrace_counters c;
+    iotrace_stats(IO_DATA, IO_WRITE, &c);
+    mt_assert(c.blocks == 2 * (NDIRECT + 1));
+    iotrace_stats(IO_INDIRECT, IO_WRITE, &c);
+    mt_assert(c.calls >= 1);
+    iotrace_stats(IO_DIR, IO_WRITE, &c);
+    mt_assert(c.calls >= 1);
+    iotrace_stats(IO_INODE, IO_WRITE, &c);
+    mt_assert(c.calls == 1);  // the files and the root share an inode block
+    iotrace_stats(IO_BITMAP, IO_WRITE, &c);
+    mt_assert(c.calls >= 1);
+    iotrace_stats(IO_SUPER, IO_READ, &c);
+    mt_assert(c.calls == 1 && c.ns > 0);
+    mt_assert(iotrace_percentile(&c, 0.5) > 0 && iotrace_percentile(&c, 0.5) <= iotrace_percentile(&c, 0.99));
+    mt_assert(io_class(IO_DATA) == IO_DATA);  // every caller put the class back
+
+    char table[2048];
+    mt_assert(iotrace_format(table, sizeof(table)) > 0 && strstr(table, "indirect") != NULL);
+    return 0;
+}
+
 void inode_tests() {
     mt_run_test(test_iget);
     mt_run_test(test_ialloc);
@@ -202,4 +707,15 @@ void inode_tests() {
     mt_run_test(test_readi);
     mt_run_test(test_read_write_mixed);
     mt_run_test(test_random_binary_read_write);
+    mt_run_test(test_delayed_allocation);
+    mt_run_test(test_delayed_bound);
+    mt_run_test(test_cylinder_groups);
+    mt_run_test(test_readahead);
+    mt_run_test(test_overwrite);
+    mt_run_test(test_icache);
+    mt_run_test(test_iflush);
+    mt_run_test(test_extents);
+    mt_run_test(test_itest_direct);
+    mt_run_test(test_l2p);
+    mt_run_test(test_iotrace);
 }
\ No newline at end of file
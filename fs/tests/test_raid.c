@@ -0,0 +1,76 @@
+#include "mintest.h"
+#include "raid.h"
+
+mt_test(test_raid_parse) {
+    raid_layout l;
+    int ports[RAID_MAXDISK];
+    mt_assert(raid_parse("9000", &l, ports) == 0);
+    mt_assert(l.level == RAID_SINGLE && l.ndisk == 1 && ports[0] == 9000);
+    mt_assert(raid_parse("raid0:9001,9002,9003", &l, ports) == 0);
+    mt_assert(l.level == RAID_0 && l.ndisk == 3 && l.unit == RAID_UNIT && ports[2] == 9003);
+    mt_assert(raid_parse("raid10:4:9001,9002,9003,9004", &l, ports) == 0);
+    mt_assert(l.level == RAID_10 && l.ndisk == 4 && l.unit == 4);
+    mt_assert(raid_parse("raid1:9001,9002", &l, ports) == 0 && l.level == RAID_1);
+
+    mt_assert(raid_parse("9000,9001", &l, ports) == -1);  // a list needs a level
+    mt_assert(raid_parse("raid5:9001,9002", &l, ports) == -1);
+    mt_assert(raid_parse("raid10:9001,9002,9003", &l, ports) == -1);  // odd
+    mt_assert(raid_parse("raid1:8:9001,9002", &l, ports) == -1);
+    mt_assert(raid_parse("raid0:0:9001", &l, ports) == -1);
+    mt_assert(raid_parse("raid0:", &l, ports) == -1);
+    return 0;
+}
+
+mt_test(test_raid0_map) {
+    raid_layout l = {RAID_0, 4, 3};
+    uint pb;
+    // units of 4 blocks go round the disks
+    mt_assert(raid_map(&l, 0, 0, &pb) == 0 && pb == 0);
+    mt_assert(raid_map(&l, 3, 0, &pb) == 0 && pb == 3);
+    mt_assert(raid_map(&l, 4, 0, &pb) == 1 && pb == 0);
+    mt_assert(raid_map(&l, 9, 0, &pb) == 2 && pb == 1);
+    mt_assert(raid_map(&l, 12, 0, &pb) == 0 && pb == 4);
+    mt_assert(raid_extent(&l, 9) == 3);
+    mt_assert(raid_ncopies(&l) == 1);
+    // 10 blocks per disk hold two whole units each
+    mt_assert(raid_capacity(&l, 10) == 24);
+
+    // every block of the array lands on a distinct place
+    static char used[3][10];
+    for (uint b = 0; b < 24; ++b) {
+        int d = raid_map(&l, b, 0, &pb);
+        mt_assert(pb < 10 && !used[d][pb]);
+        used[d][pb] = 1;
+    }
+    return 0;
+}
+
+mt_test(test_raid1_map) {
+    raid_layout l = {RAID_1, RAID_UNIT, 3};
+    uint pb;
+    mt_assert(raid_ncopies(&l) == 3);
+    for (int c = 0; c < 3; ++c) mt_assert(raid_map(&l, 77, c, &pb) == c && pb == 77);
+    mt_assert(raid_capacity(&l, 1000) == 1000);
+    return 0;
+}
+
+mt_test(test_raid10_map) {
+    raid_layout l = {RAID_10, 2, 4};
+    uint pb;
+    mt_assert(raid_ncopies(&l) == 2);
+    // units alternate between the pairs (0, 1) and (2, 3)
+    mt_assert(raid_map(&l, 1, 0, &pb) == 0 && pb == 1);
+    mt_assert(raid_map(&l, 1, 1, &pb) == 1 && pb == 1);
+    mt_assert(raid_map(&l, 2, 0, &pb) == 2 && pb == 0);
+    mt_assert(raid_map(&l, 2, 1, &pb) == 3 && pb == 0);
+    mt_assert(raid_map(&l, 5, 1, &pb) == 1 && pb == 3);
+    mt_assert(raid_capacity(&l, 9) == 16);
+    return 0;
+}
+
+void raid_tests() {
+    mt_run_test(test_raid_parse);
+    mt_run_test(test_raid0_map);
+    mt_run_test(test_raid1_map);
+    mt_run_test(test_raid10_map);
+}
@@ -0,0 +1,74 @@
+/* ********************************
+ * Description:  Commands understood by the block device server (BDS)
+ *
+ *   I                  -> "<cylinders> <sectors per cylinder>"
+ *   R c s              -> "Yes <512 bytes>" or "No "
+ *   W c s l data       -> "Yes " or "No "
+ *   RV c s n           -> "Yes <n * 512 bytes>" or "No "
+ *   WV c s n data      -> "Yes " or "No ", data is n * 512 bytes
+ *   D c s n            -> "Yes " or "No ", discard n sectors, they read as zeros
+ *   F                  -> "Yes " once every earlier write is durable
+ *   S [reset]          -> "Yes <statistics as text>", reset clears them after
+ *   B                  -> "Yes ", switch the connection to binary framing
+ *   E                  -> "Bye!"
+ *
+ * RV and WV cover n consecutive sectors starting at (c, s) and may run
+ * past the end of cylinder c into the following cylinders, as does D, which
+ * carries no data and may cover up to BDS_MAXDISCARD sectors.
+ *
+ * After B every message in both directions is a bds_hdr, followed by the
+ * sectors of a write request or of a read response. Sectors are addressed
+ * by LBA (cylinder * sectors per cylinder + sector). Text clients such as
+ * BDC never send B and keep the commands above.
+ *
+ * A client may pipeline binary requests. The server queues them and may
+ * complete them in any order, so responses are matched by tag. Requests
+ * that overlap a write or a discard, or come before or after a FLUSH, keep
+ * their order.
+ ********************************/
+
+#ifndef _BDS_PROTO_
+#define _BDS_PROTO_
+
+#include <stdint.h>
+
+#define BDS_SECSIZE 512
+
+// most sectors a single RV / WV may cover, keeps a message well inside
+// one tcp_buffer (TCP_BUF_SIZE must be at least twice the message size)
+#define BDS_MAXSEC 64
+
+// most sectors a single discard may cover
+#define BDS_MAXDISCARD 8192
+
+#define BDS_MAGIC 0xBD
+
+// binary requests the server queues per connection before servicing them,
+// a client may keep this many in flight
+#define BDS_QDEPTH 16
+
+enum {
+    BDS_OP_INFO = 1,   // response: lba = cylinders, count = sectors per cylinder
+    BDS_OP_READ = 2,
+    BDS_OP_WRITE = 3,
+    BDS_OP_FLUSH = 4,
+    BDS_OP_DISCARD = 5,
+};
+
+enum {
+    BDS_OK = 0,
+    BDS_EINVAL = 1,  // malformed request or out of range
+    BDS_EIO = 2,     // the disk failed
+};
+
+// fields are in network byte order on the wire
+typedef struct {
+    uint8_t magic;
+    uint8_t opcode;
+    uint16_t status;  // set in responses
+    uint32_t tag;     // chosen by the client, echoed in the response
+    uint32_t lba;
+    uint32_t count;   // sectors
+} bds_hdr;
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef _TCP_BUFFER_
 #define _TCP_BUFFER_
 
-#define TCP_BUF_SIZE 4096
+// large enough for two of the biggest BDS messages (see bds_proto.h),
+// a partial message must still fit after adjust_buffer()
+#define TCP_BUF_SIZE (1 << 17)
 
 typedef struct tcp_buffer {
     int read_index;
@@ -56,7 +58,7 @@ void send_buffer(tcp_buffer *buf, int sockfd);
 /**
  * @brief  Adjust buffer
  *
- * If read_index is larger than TCP_BUF_SIZE / 2,
+ * If read_index is larger than TCP_BUF_SIZE / 2, or the buffer is empty,
  * move the data to the beginning of the buffer.
  * Used after recycle_read and recycle_write.
  *
@@ -27,6 +27,21 @@ typedef struct tcp_client_ *tcp_client;
 tcp_server server_init(int port, int num_threads, void (*on_connection)(int id),
                        int (*on_recv)(int id, tcp_buffer *write_buf, char *msg, int len), void (*cleanup)(int id));
 
+/**
+ * @brief  Set the drain handler of a server
+ *
+ * Lets on_recv queue messages instead of answering them at once. After the
+ * received messages have been passed to on_recv, on_drain is called to run
+ * the queued ones in any order it likes. It returns the number of messages
+ * still queued, in which case the write buffer is sent and it is called
+ * again. on_recv returns 1 when its queue is full, and on_drain is called
+ * before the next message is passed to it.
+ *
+ * @param  server    server to be configured
+ * @param  on_drain  function to be called, can be NULL
+ */
+void server_set_on_drain(tcp_server server, int (*on_drain)(int id, tcp_buffer *write_buf));
+
 /**
  * @brief  Start the server loop
  *
@@ -73,6 +88,20 @@ void client_send(tcp_client client, const char *msg, int len);
  */
 int client_recv(tcp_client client, char *buf, int max_len);
 
+/**
+ * @brief  Wait for a message from any of several servers
+ *
+ * Wait until a message from one of the clients' servers is buffered or starts
+ * arriving, so that client_recv() on it does not wait for the server.
+ *
+ * @param  clients     clients to wait on
+ * @param  n           number of clients
+ * @param  timeout_ms  longest wait, 0 to poll, negative to wait forever
+ *
+ * @return int         index of a client with a message, -1 on timeout or error
+ */
+int client_select(tcp_client *clients, int n, int timeout_ms);
+
 /**
  * @brief  Destroy a TCP client
  *
@@ -2,6 +2,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,7 +20,8 @@ tcp_buffer *init_buffer() {
 }
 
 void adjust_buffer(tcp_buffer *buf) {
-    if (buf->read_index > TCP_BUF_SIZE / 2) {
+    // an empty buffer is always rewound, so a whole reply fits after send_buffer()
+    if (buf->read_index > TCP_BUF_SIZE / 2 || buf->read_index == buf->write_index) {
         int len = buf->write_index - buf->read_index;
         if (buf->read_index >= 0 && buf->read_index <= buf->write_index && buf->write_index <= TCP_BUF_SIZE) {
             memmove(buf->buf, &buf->buf[buf->read_index], len);
@@ -107,6 +109,12 @@ void send_buffer(tcp_buffer *buf, int sockfd) {
     while (buf->write_index > buf->read_index) {
         int readable = buf->write_index - buf->read_index;
         int ret = send(sockfd, &buf->buf[buf->read_index], readable, 0);
+        if (ret < 0 && (errno == EINTR || errno == EWOULDBLOCK || errno == EAGAIN)) {
+            // non-blocking socket is full, wait until the peer reads
+            struct pollfd pfd = {sockfd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+            continue;
+        }
         if (ret <= 0) {
             perror("send()");
             break;
@@ -32,6 +32,7 @@ typedef struct tcp_server_ {
     void (*on_connection)(int id);
     int (*on_recv)(int id, tcp_buffer *write_buf, char *msg, int len);
     void (*cleanup)(int id);
+    int (*on_drain)(int id, tcp_buffer *write_buf);
     int port;
     int listenfd;
     struct tcp_server_pool pool;
@@ -102,19 +103,31 @@ void handle_read(void *arg_p) {
     if (count > 0) {
         printf("Server received %d bytes on fd %d\n", count, connfd);
 
-        while (1) {  // handle all messages in the buffer
-            int readable = read_buf->write_index - read_buf->read_index;
-            char *s = &read_buf->buf[read_buf->read_index];
-            // the first 4 bytes is the length of the message
-            if (readable < 4) break;
-            // network long to host long
-            int len = ntohl(*(int *)s);
-            // if the message is complete
-            if (readable >= len + 4) {
-                if (server->on_recv(i, write_buf, s + 4, len) < 0) close_flag = 1;
-                recycle_read(read_buf, len + 4);
-            } else
-                break;
+        int more = 1;
+        while (more) {
+            more = 0;
+            while (1) {  // handle all messages in the buffer
+                int readable = read_buf->write_index - read_buf->read_index;
+                char *s = &read_buf->buf[read_buf->read_index];
+                // the first 4 bytes is the length of the message
+                if (readable < 4) break;
+                // network long to host long
+                int len = ntohl(*(int *)s);
+                // if the message is complete
+                if (readable >= len + 4) {
+                    int ret = server->on_recv(i, write_buf, s + 4, len);
+                    if (ret < 0) close_flag = 1;
+                    recycle_read(read_buf, len + 4);
+                    // the handler queued it and cannot take more, drain first
+                    if (ret > 0) {
+                        more = 1;
+                        break;
+                    }
+                } else
+                    break;
+            }
+            // run what on_recv queued, sending replies whenever on_drain runs out of room
+            while (server->on_drain && server->on_drain(i, write_buf) > 0) send_buffer(write_buf, connfd);
         }
     }
 
@@ -144,6 +157,7 @@ tcp_server_ *server_init(int port, int num_threads, void (*on_connection)(int id
     server->on_connection = on_connection;
     server->on_recv = on_recv;
     server->cleanup = cleanup;
+    server->on_drain = NULL;
 
     if (!on_recv) {
         fprintf(stderr, "on_recv() cannot be NULL\n");
@@ -190,6 +204,11 @@ tcp_server_ *server_init(int port, int num_threads, void (*on_connection)(int id
     return server;
 }
 
+/* Set the drain handler */
+void server_set_on_drain(tcp_server_ *server, int (*on_drain)(int id, tcp_buffer *write_buf)) {
+    server->on_drain = on_drain;
+}
+
 /* Start the server loop, never returns */
 int server_run(tcp_server_ *server) {
     while (1) {
@@ -276,21 +295,14 @@ void client_send(tcp_client_ *client, const char *msg, int len) {
 /* Receive a message from the server */
 int client_recv(tcp_client_ *client, char *buf, int max_len) {
     tcp_buffer *read_buf = client->read_buf;
-    // read all data from the socket
     while (1) {
-        int count = read_to_buffer(read_buf, client->sockfd);
-        if (count <= 0) {
-            printf("Connection closed\n");
-            return 0;
-        }
         int readable = read_buf->write_index - read_buf->read_index;
         char *s = &read_buf->buf[read_buf->read_index];
         // the first 4 bytes is the length of the message
-        if (readable < 4) continue;
         // network long to host long
-        int len = ntohl(*(int *)s);
-        // if the message is complete
-        if (readable >= len + 4) {
+        int len = readable < 4 ? 0 : ntohl(*(int *)s);
+        // a pipelined reply may already be complete in the buffer
+        if (readable >= 4 && readable >= len + 4) {
             if (len > max_len) {
                 fprintf(stderr, "client_recv: buffer too small\n");
                 exit(EXIT_FAILURE);
@@ -299,9 +311,35 @@ int client_recv(tcp_client_ *client, char *buf, int max_len) {
             memcpy(buf, s + 4, len);
             recycle_read(read_buf, len + 4);
             return len;
-        } else
-            continue;
+        }
+        // read all data from the socket
+        int count = read_to_buffer(read_buf, client->sockfd);
+        if (count <= 0) {
+            printf("Connection closed\n");
+            return 0;
+        }
+    }
+}
+
+/* Wait until one of several clients has a message to receive */
+int client_select(tcp_client_ **clients, int n, int timeout_ms) {
+    fd_set set;
+    FD_ZERO(&set);
+    int maxfd = -1;
+    for (int i = 0; i < n; ++i) {
+        tcp_buffer *read_buf = clients[i]->read_buf;
+        int readable = read_buf->write_index - read_buf->read_index;
+        char *s = &read_buf->buf[read_buf->read_index];
+        // a whole message already buffered needs no wait
+        if (readable >= 4 && readable >= (int)ntohl(*(int *)s) + 4) return i;
+        FD_SET(clients[i]->sockfd, &set);
+        if (clients[i]->sockfd > maxfd) maxfd = clients[i]->sockfd;
     }
+    struct timeval tv = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+    if (select(maxfd + 1, &set, NULL, NULL, timeout_ms < 0 ? NULL : &tv) <= 0) return -1;
+    for (int i = 0; i < n; ++i)
+        if (FD_ISSET(clients[i]->sockfd, &set)) return i;
+    return -1;
 }
 
 /* Destroy the client */